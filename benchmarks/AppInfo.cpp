@@ -0,0 +1,359 @@
+#include <benchmark/benchmark.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+import std;
+import llvm.Support;
+
+import wm.AppInfoLoader;
+import wm.AppInfoLoader.BatchReader;
+import wm.AppInfoLoader.Xdg;
+
+using std::size_t;
+using namespace wm;
+namespace fs = llvm::sys::fs;
+using namespace std::chrono_literals;
+
+// Synthetic corpora shaped like a desktop with a lot of packages installed:
+//
+// - most files are a few hundred bytes to a couple of KiB,
+// - ~15% are heavily localized (Name/GenericName/Comment/Keywords in ~100
+//   locales, tens of KiB), like LibreOffice and GNOME apps,
+// - ~30% have [Desktop Action] groups,
+// - ~75% lack StartupWMClass, ~5% lack Icon, and a few are not desktop files,
+// - ~80% live in /usr/share/applications, some in a vendor subdirectory, and a
+//   few in ~/.local/share/applications, overriding system files.
+//
+// Generation is deterministic so that runs are comparable.
+
+static constexpr std::string_view locales[] = {
+    "af", "ar", "as", "ast", "be", "bg", "bn", "br", "bs", "ca", "cs", "cy", "da", "de",
+    "el", "en_GB", "eo", "es", "et", "eu", "fa", "fi", "fr", "fy", "ga", "gd", "gl",
+    "gu", "he", "hi", "hr", "hu", "hy", "id", "is", "it", "ja", "ka", "kk", "km", "kn",
+    "ko", "lt", "lv", "mk", "ml", "mr", "ms", "nb", "ne", "nl", "nn", "oc", "or", "pa",
+    "pl", "pt", "pt_BR", "ro", "ru", "si", "sk", "sl", "sq", "sr", "sv", "ta", "te",
+    "th", "tr", "uk", "ur", "uz", "vi", "zh_CN", "zh_TW",
+};
+
+static std::string make_desktop_file(std::mt19937 &rng, size_t i)
+{
+	auto chance = [&rng](int percent) {
+		return std::uniform_int_distribution<int>(0, 99)(rng) < percent;
+	};
+
+	if (chance(1))
+		return "# not a desktop file\n";
+
+	bool localized = chance(15);
+	auto translate = [&](std::string &out, std::string_view key, std::string_view value) {
+		if (!localized)
+			return;
+		for (auto locale : locales) {
+			std::format_to(
+			    std::back_inserter(out), "{}[{}]={} ({})\n", key, locale, value, locale
+			);
+		}
+	};
+
+	std::string out = "[Desktop Entry]\nType=Application\nVersion=1.0\n";
+	std::format_to(std::back_inserter(out), "Name=Application {}\n", i);
+	translate(out, "Name", std::format("Application {}", i));
+	out += "GenericName=Utility\n";
+	translate(out, "GenericName", "Utility");
+	out += "Comment=Does something useful with files and other things\n";
+	translate(out, "Comment", "Does something useful with files and other things");
+	std::format_to(std::back_inserter(out), "Exec=app{} %U\nTerminal=false\n", i);
+	if (!chance(5))
+		std::format_to(std::back_inserter(out), "Icon=app-icon-{}\n", i % 500);
+	out += "Categories=Utility;Development;\nMimeType=text/plain;application/x-app;\n";
+	out += "Keywords=edit;text;tool;\n";
+	translate(out, "Keywords", "edit;text;tool;");
+	if (chance(25))
+		std::format_to(std::back_inserter(out), "StartupWMClass=App{}\n", i);
+	out += "StartupNotify=true\n";
+
+	if (chance(30)) {
+		for (auto action : {"new-window", "new-private-window"}) {
+			std::format_to(std::back_inserter(out), "\n[Desktop Action {}]\n", action);
+			out += "Name=New Window\n";
+			translate(out, "Name", "New Window");
+			std::format_to(std::back_inserter(out), "Exec=app{} --{}\n", i, action);
+		}
+	}
+
+	return out;
+}
+
+static void write_file(const llvm::SmallString<256> &path, std::string_view content)
+{
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1)
+		throw std::runtime_error(std::strerror(errno));
+	auto written = write(fd, content.data(), content.size());
+	close(fd);
+	if (static_cast<size_t>(written) != content.size())
+		throw std::runtime_error("short write");
+}
+
+struct Corpus {
+	llvm::SmallString<256>   root;
+	llvm::SmallString<256>   data_home;
+	llvm::SmallString<256>   data_dir1;
+	llvm::SmallString<256>   data_dir2;
+	llvm::SmallString<256>   cache_home;
+	/// absolute paths of the files in /usr/share/applications
+	std::vector<std::string> sys_files;
+	std::vector<std::string> contents;
+	std::vector<std::string> app_ids;
+	size_t                   num_files   = 0;
+	size_t                   total_bytes = 0;
+
+	explicit Corpus(size_t n)
+	{
+		if (auto ec = fs::createUniqueDirectory("appinfo_bench", root))
+			throw std::runtime_error(ec.message());
+
+		auto subdir = [this](llvm::StringRef name) {
+			llvm::SmallString<256> dir(root);
+			llvm::sys::path::append(dir, name);
+			return dir;
+		};
+		data_home  = subdir("home");
+		data_dir1  = subdir("usr-share");
+		data_dir2  = subdir("usr-local-share");
+		cache_home = subdir("cache");
+
+		auto apps = [](const llvm::SmallString<256> &base, llvm::StringRef sub = "") {
+			llvm::SmallString<256> dir(base);
+			llvm::sys::path::append(dir, "applications", sub);
+			if (auto ec = fs::create_directories(dir))
+				throw std::runtime_error(ec.message());
+			return dir;
+		};
+		auto home_apps   = apps(data_home);
+		auto sys_apps    = apps(data_dir1);
+		auto vendor_apps = apps(data_dir1, "vendor");
+		auto local_apps  = apps(data_dir2);
+
+		std::mt19937 rng(n);
+		for (size_t i = 0; i < n; i++) {
+			auto content = make_desktop_file(rng, i);
+			auto bucket  = std::uniform_int_distribution<int>(0, 99)(rng);
+
+			llvm::SmallString<256> path;
+			std::string            app_id;
+			if (bucket < 5) {
+				// overrides a system file
+				auto id = std::format("app{}", i / 2);
+				path    = home_apps;
+				llvm::sys::path::append(path, id + ".desktop");
+				app_id = id;
+			} else if (bucket < 80) {
+				auto id = std::format("app{}", i);
+				path    = sys_apps;
+				llvm::sys::path::append(path, id + ".desktop");
+				app_id = id;
+				sys_files.emplace_back(path.str());
+			} else if (bucket < 90) {
+				auto id = std::format("app{}", i);
+				path    = vendor_apps;
+				llvm::sys::path::append(path, id + ".desktop");
+				app_id = "vendor-" + id;
+			} else {
+				auto id = std::format("app{}", i);
+				path    = local_apps;
+				llvm::sys::path::append(path, id + ".desktop");
+				app_id = id;
+			}
+
+			write_file(path, content);
+			total_bytes += content.size();
+			contents.push_back(std::move(content));
+			app_ids.push_back(std::move(app_id));
+		}
+		num_files = n;
+	}
+
+	~Corpus() { auto _ = fs::remove_directories(root); }
+
+	void set_env() const
+	{
+		setenv("XDG_DATA_HOME", data_home.c_str(), 1);
+		auto data_dirs = std::format("{}:{}", data_dir1.c_str(), data_dir2.c_str());
+		setenv("XDG_DATA_DIRS", data_dirs.c_str(), 1);
+		setenv("XDG_CACHE_HOME", cache_home.c_str(), 1);
+	}
+
+	void remove_index_cache() const
+	{
+		llvm::SmallString<256> path(cache_home);
+		llvm::sys::path::append(path, "wm", "app-index");
+		auto _ = fs::remove(path);
+	}
+};
+
+/// Corpora are expensive to generate, so each size is made once per run.
+static const Corpus &get_corpus(size_t n)
+{
+	static std::map<size_t, std::unique_ptr<Corpus>> corpora;
+	auto &corpus = corpora[n];
+	if (!corpus)
+		corpus = std::make_unique<Corpus>(n);
+	return *corpus;
+}
+
+static void set_counters(benchmark::State &state, size_t files, size_t bytes)
+{
+	state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * files));
+	state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes));
+}
+
+static void wait_until_available(AppInfoLoader &loader)
+{
+	while (!loader.is_available())
+		std::this_thread::sleep_for(50us);
+}
+
+static void BM_GetDesktopFileInfo(benchmark::State &state)
+{
+	auto level = static_cast<SimdLevel>(state.range(0));
+	if (level > get_simd_level()) {
+		state.SkipWithError("not supported by this CPU");
+		return;
+	}
+
+	const auto &corpus = get_corpus(1000);
+
+	std::vector<std::pair<unique_aligned_ptr, int>> buffers;
+	for (const auto &content : corpus.contents) {
+		auto size   = static_cast<int>(content.size());
+		auto buffer = make_desktop_file_buffer(size);
+		std::memcpy(buffer.get(), content.data(), size);
+		buffers.emplace_back(std::move(buffer), size);
+	}
+
+	for (auto _ : state) {
+		for (const auto &[buffer, size] : buffers)
+			benchmark::DoNotOptimize(get_desktop_file_info(buffer.get(), size, level));
+	}
+	set_counters(state, corpus.num_files, corpus.total_bytes);
+}
+BENCHMARK(BM_GetDesktopFileInfo)
+    ->ArgName("simd_level")
+    ->Arg(static_cast<int>(SimdLevel::SSE2))
+    ->Arg(static_cast<int>(SimdLevel::AVX2))
+    ->Arg(static_cast<int>(SimdLevel::AVX512BW));
+
+// Page cache is warm after the first iteration; this measures syscalls and
+// copies, not the disk.
+static void BM_ReadDesktopFile(benchmark::State &state)
+{
+	const auto &corpus = get_corpus(state.range(0));
+	for (auto _ : state) {
+		for (const auto &path : corpus.sys_files) {
+			int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			benchmark::DoNotOptimize(read_desktop_file(fd));
+			close(fd);
+		}
+	}
+	set_counters(state, corpus.sys_files.size(), 0);
+}
+BENCHMARK(BM_ReadDesktopFile)->RangeMultiplier(10)->Range(100, 10'000);
+
+static void BM_BatchReader(benchmark::State &state)
+{
+	const auto &corpus = get_corpus(state.range(0));
+
+	llvm::SmallString<256> dir(corpus.data_dir1);
+	llvm::sys::path::append(dir, "applications");
+	int dfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	std::vector<std::string> filenames;
+	for (const auto &path : corpus.sys_files)
+		filenames.emplace_back(llvm::sys::path::filename(path));
+
+	BatchReader reader;
+	if (!reader.uses_io_uring())
+		state.SetLabel("fallback");
+	for (auto _ : state)
+		benchmark::DoNotOptimize(reader.read(dfd, filenames));
+	set_counters(state, filenames.size(), 0);
+
+	close(dfd);
+}
+BENCHMARK(BM_BatchReader)->RangeMultiplier(10)->Range(100, 10'000);
+
+/// From construction to `is_available()`, without the index cache.
+static void BM_AppInfoLoaderColdScan(benchmark::State &state)
+{
+	const auto &corpus = get_corpus(state.range(0));
+	corpus.set_env();
+
+	AppInfoLoaderConfig config{.icon_size = 48, .icon_theme = ""};
+	for (auto _ : state) {
+		state.PauseTiming();
+		corpus.remove_index_cache();
+		state.ResumeTiming();
+
+		AppInfoLoader loader(config);
+		wait_until_available(loader);
+	}
+	set_counters(state, corpus.num_files, corpus.total_bytes);
+}
+BENCHMARK(BM_AppInfoLoaderColdScan)
+    ->Arg(100)
+    ->Arg(1'000)
+    ->Arg(10'000)
+    ->Arg(50'000)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+/// From construction to `is_available()`, with an up-to-date index cache.
+static void BM_AppInfoLoaderWarmScan(benchmark::State &state)
+{
+	const auto &corpus = get_corpus(state.range(0));
+	corpus.set_env();
+
+	AppInfoLoaderConfig config{.icon_size = 48, .icon_theme = ""};
+	{
+		AppInfoLoader loader(config);
+		wait_until_available(loader);
+	}
+	for (auto _ : state) {
+		AppInfoLoader loader(config);
+		wait_until_available(loader);
+	}
+	set_counters(state, corpus.num_files, corpus.total_bytes);
+}
+BENCHMARK(BM_AppInfoLoaderWarmScan)
+    ->Arg(100)
+    ->Arg(1'000)
+    ->Arg(10'000)
+    ->Arg(50'000)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+/// Hits with the occasional miss, as when resolving the app IDs of windows.
+static void BM_GetAppInfo(benchmark::State &state)
+{
+	const auto &corpus = get_corpus(state.range(0));
+	corpus.set_env();
+
+	AppInfoLoaderConfig config{.icon_size = 48, .icon_theme = ""};
+	AppInfoLoader       loader(config);
+	wait_until_available(loader);
+
+	std::mt19937             rng(42);
+	std::vector<std::string> queries;
+	for (int i = 0; i < 4096; i++) {
+		auto j = std::uniform_int_distribution<size_t>(0, corpus.app_ids.size() - 1)(rng);
+		queries.push_back(i % 16 ? corpus.app_ids[j] : std::format("missing{}", j));
+	}
+
+	for (auto _ : state) {
+		for (const auto &query : queries)
+			benchmark::DoNotOptimize(loader.get_app_info(query));
+	}
+	set_counters(state, queries.size(), 0);
+}
+BENCHMARK(BM_GetAppInfo)->RangeMultiplier(10)->Range(100, 10'000);
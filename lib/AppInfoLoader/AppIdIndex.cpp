@@ -0,0 +1,157 @@
+module wm.AppInfoLoader.AppIdIndex;
+
+import std;
+import absl;
+
+using namespace wm;
+
+/// Average keys per bucket. Larger buckets make the index smaller and the
+/// build slower.
+static constexpr size_t bucket_size = 4;
+
+/// Pilots tried per bucket before the build gives up and re-seeds. Buckets
+/// almost always place within a few hundred.
+static constexpr uint32_t max_pilot = 1 << 16;
+
+/// splitmix64's finalizer, to spread consecutive pilots and the keys they
+/// are combined with over the slots.
+static uint64_t mix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111eb;
+	x ^= x >> 31;
+	return x;
+}
+
+static uint64_t load_prefix(std::string_view key)
+{
+	uint64_t prefix = 0;
+	std::memcpy(&prefix, key.data(), std::min<size_t>(key.length(), sizeof(prefix)));
+	return prefix;
+}
+
+namespace wm {
+
+AppIdIndex::AppIdIndex(
+    std::span<const std::pair<std::string_view, uint32_t>> entries, uint64_t seed
+) :
+    seed(seed)
+{
+	// fails when two keys of one bucket collide in all 64 bits, or a bucket
+	// runs out of pilots
+	while (!build(entries))
+		this->seed++;
+}
+
+uint64_t AppIdIndex::hash(std::string_view key) const { return absl::HashOf(seed, key); }
+
+size_t AppIdIndex::bucket(uint64_t h) const
+{ return static_cast<size_t>((h >> 32) * pilots.size() >> 32); }
+
+// Remixing after the XOR makes every pilot move all 64 bits, and the
+// multiply-shift maps them onto the slots from the high bits. A plain modulo
+// would only keep the low bits for power-of-two sizes, which keys sharing
+// them keep sharing whatever the pilot.
+size_t AppIdIndex::position(uint64_t h, uint32_t pilot) const
+{
+	auto mixed = static_cast<unsigned __int128>(mix(h ^ mix(pilot)));
+	return static_cast<size_t>(mixed * slots.size() >> 64);
+}
+
+bool AppIdIndex::build(std::span<const std::pair<std::string_view, uint32_t>> entries)
+{
+	pilots.clear();
+	slots.clear();
+	if (entries.empty())
+		return true;
+
+	pilots.resize(entries.size() / bucket_size + 1);
+	slots.resize(entries.size());
+
+	struct Key {
+		uint64_t hash;
+		uint32_t bucket;
+		uint32_t entry;
+	};
+	std::vector<Key> keys;
+	keys.reserve(entries.size());
+	for (const auto &[i, entry] : entries | std::views::enumerate) {
+		auto h = hash(entry.first);
+		keys.push_back({
+		    .hash   = h,
+		    .bucket = static_cast<uint32_t>(bucket(h)),
+		    .entry  = static_cast<uint32_t>(i),
+		});
+	}
+	std::ranges::sort(keys, {}, [](const Key &k) { return std::pair{k.bucket, k.hash}; });
+
+	// [first, last) ranges of `keys`, largest buckets first since they are
+	// the hardest to place
+	std::vector<std::pair<uint32_t, uint32_t>> buckets;
+	for (size_t first = 0; first < keys.size();) {
+		auto last = first + 1;
+		while (last < keys.size() && keys[last].bucket == keys[first].bucket) {
+			if (keys[last].hash == keys[last - 1].hash) [[unlikely]]
+				return false;
+			last++;
+		}
+		buckets.emplace_back(first, last);
+		first = last;
+	}
+	std::ranges::stable_sort(buckets, std::greater{}, [](auto b) { return b.second - b.first; });
+
+	std::vector<bool>   taken(slots.size());
+	std::vector<size_t> positions;
+	for (auto [first, last] : buckets) {
+		for (uint32_t pilot = 0;; pilot++) {
+			if (pilot == max_pilot) [[unlikely]]
+				return false;
+			positions.clear();
+			for (auto i = first; i < last; i++) {
+				auto pos = position(keys[i].hash, pilot);
+				if (taken[pos] || std::ranges::contains(positions, pos))
+					break;
+				positions.push_back(pos);
+			}
+			if (positions.size() != last - first)
+				continue;
+
+			pilots[keys[first].bucket] = pilot;
+			for (auto [i, pos] : std::views::zip(std::views::iota(first, last), positions)) {
+				const auto &[key, value] = entries[keys[i].entry];
+				auto       &slot         = slots[pos];
+				slot.prefix              = load_prefix(key);
+				slot.length              = static_cast<uint32_t>(key.length());
+				slot.value               = value;
+				slot.key                 = key.data();
+				taken[pos]               = true;
+			}
+			break;
+		}
+	}
+	return true;
+}
+
+std::pair<const char *, uint32_t> AppIdIndex::find(std::string_view key) const
+{
+	if (slots.empty()) [[unlikely]]
+		return {nullptr, 0};
+
+	auto        h    = hash(key);
+	const auto &slot = slots[position(h, pilots[bucket(h)])];
+	if (slot.length != key.length() || slot.prefix != load_prefix(key))
+		return {nullptr, 0};
+	if (key.length() > sizeof(slot.prefix)
+	    && std::memcmp(
+	        slot.key + sizeof(slot.prefix),
+	        key.data() + sizeof(slot.prefix),
+	        key.length() - sizeof(slot.prefix)
+	    )) {
+		return {nullptr, 0};
+	}
+	return {slot.key, slot.value};
+}
+
+} // namespace wm
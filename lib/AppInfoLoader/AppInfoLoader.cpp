@@ -7,7 +7,10 @@ module;
 #include <tmmintrin.h>
 
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -18,7 +21,12 @@ module wm.AppInfoLoader;
 import std;
 import llvm.Support;
 
+import wm.AppInfoLoader.AppIdIndex;
+import wm.AppInfoLoader.BatchReader;
+import wm.AppInfoLoader.IconTheme;
 import wm.AppInfoLoader.Image;
+import wm.AppInfoLoader.ImageCache;
+import wm.AppInfoLoader.IndexCache;
 import wm.AppInfoLoader.Xdg;
 
 using namespace wm;
@@ -26,12 +34,45 @@ using namespace wm;
 const gchar *AppInfoLoader::icon_fallbacks[]  = {"hicolor", nullptr};
 const gchar *AppInfoLoader::sound_fallbacks[] = {nullptr};
 
+static constexpr uint32_t watch_mask = IN_CREATE
+                                       | IN_CLOSE_WRITE
+                                       | IN_DELETE
+                                       | IN_MOVED_FROM
+                                       | IN_MOVED_TO
+                                       | IN_DELETE_SELF
+                                       | IN_MOVE_SELF
+                                       | IN_ONLYDIR;
+
+/// For the nearest existing ancestor of a missing app dir. Added to the mask
+/// of a watch the path may already have.
+static constexpr uint32_t ancestor_watch_mask = IN_CREATE
+                                                | IN_MOVED_TO
+                                                | IN_DELETE_SELF
+                                                | IN_MOVE_SELF
+                                                | IN_ONLYDIR
+                                                | IN_MASK_ADD;
+
+static constexpr std::string_view desktop_file_extension = ".desktop";
+
+static constexpr unsigned max_scan_threads   = 4;
+static constexpr unsigned max_decode_threads = 4;
+static constexpr size_t   scan_batch_size    = 64;
+/// Nothing real nests this deep; guards against pathological trees.
+static constexpr uint32_t max_scan_depth     = 8;
+
 AppInfoLoader::AppInfoLoader(const AppInfoLoaderConfig &config) :
     string_saver(string_alloc),
     theme_context(nk_xdg_theme_context_new(icon_fallbacks, sound_fallbacks)),
+    inotify_fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)),
+    icon_event_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+    scan_event_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+    fallback_generation(0),
+    icon_lookups_waiting(false),
+    next_task_seq(0),
     scan_finished_flag(false),
     worker_processing_tasks(false),
-    shutdown_flag(false)
+    shutdown_flag(false),
+    watch_overflowed(false)
 {
 	reset_config(config);
 	worker = std::thread(&AppInfoLoader::scan, this);
@@ -39,33 +80,23 @@ AppInfoLoader::AppInfoLoader(const AppInfoLoaderConfig &config) :
 
 void AppInfoLoader::reset_config(const AppInfoLoaderConfig &config)
 {
-	bool was_running = worker.joinable();
-	if (was_running) {
-		// worker is either scanning or in the task loop
-		if (!worker_processing_tasks) {
-			worker.join();
-			worker_processing_tasks = true;
-			// will start the task loop after this
-		} else {
-			// wait until task queue is empty
-			std::promise<Image> promise;
-			auto                fut = promise.get_future();
-			{
-				std::lock_guard lk(mtx);
-				task_queue.emplace("", std::move(promise));
-			}
-			cv.notify_one();
-			fut.wait();
-			{
-				std::lock_guard lk(mtx);
-				shutdown_flag = true;
-			}
-			cv.notify_all();
-			worker.join();
-			shutdown_flag = false;
-		}
+	// Queued icons carry the size they were requested at, so the decode
+	// threads keep running. The scan has to finish before the records can
+	// be touched.
+	if (worker.joinable() && !worker_processing_tasks) {
+		worker.join();
+		worker_processing_tasks = true;
+		start_decode_threads();
+		watch_missing_app_dirs();
+		apply_pending_changes();
 	}
 
+	// the loader for the old config must not publish its themes afterwards
+	if (icon_theme_loader.valid())
+		icon_theme_loader.wait();
+
+	// decode threads may be asking nk with the old themes
+	std::unique_lock nk_lk(nk_mtx);
 	icon_size = static_cast<uint16_t>(config.icon_size);
 
 	for (auto &theme : icon_themes)
@@ -91,12 +122,41 @@ void AppInfoLoader::reset_config(const AppInfoLoaderConfig &config)
 	}
 	icon_themes.push_back(nullptr);
 
-	if (was_running)
-		worker = std::thread(&AppInfoLoader::worker_thread, this);
+	std::vector<std::string> names(icon_themes.begin(), icon_themes.end() - 1);
+	nk_lk.unlock();
+
+	// resolved against the old size and themes
+	icon_theme_index.reset();
+	records.icon_resolved.assign(records.icon_resolved.size(), false);
+	{
+		std::lock_guard lk(mtx);
+		loaded_icon_themes.reset();
+		fallback_queue.clear();
+		fallback_paths.clear();
+		fallback_generation++;
+	}
+
+	icon_theme_loader = std::async(
+	    std::launch::async, [this, names = std::move(names), size = icon_size] {
+		    std::vector<std::string_view> views(names.begin(), names.end());
+		    // what nk falls back to when no theme is configured
+		    auto gtk_theme = views.empty() ? get_gtk_icon_theme_name() : std::string{};
+		    if (!gtk_theme.empty())
+			    views.push_back(gtk_theme);
+		    auto themes = std::make_unique<IconThemes>(views, size);
+
+		    std::lock_guard lk(mtx);
+		    loaded_icon_themes = std::move(themes);
+		    wake_icon_lookups();
+	    }
+	);
 }
 
 AppInfoLoader::~AppInfoLoader()
 {
+	// it signals `icon_event_fd`
+	if (icon_theme_loader.valid())
+		icon_theme_loader.wait();
 	{
 		std::lock_guard lk(mtx);
 		shutdown_flag = true;
@@ -105,181 +165,1068 @@ AppInfoLoader::~AppInfoLoader()
 
 	if (worker.joinable())
 		worker.join();
+	for (auto &thread : decode_threads)
+		thread.join();
 
 	for (auto &theme : icon_themes)
 		delete[] theme; // no-op when nullptr
+
+	if (inotify_fd != -1)
+		close(inotify_fd);
+	if (icon_event_fd != -1)
+		close(icon_event_fd);
+	if (scan_event_fd != -1)
+		close(scan_event_fd);
+}
+
+/// Per-thread work item of `AppInfoLoader::scan()`.
+struct ScanTask {
+	uint32_t                 dir_idx;
+	/// desktop files to parse; empty to list the directory instead
+	std::vector<std::string> filenames;
+};
+
+static bool is_subdir(int dfd, const struct dirent *dp)
+{
+	if (dp->d_type == DT_DIR)
+		return true;
+	if (dp->d_type != DT_UNKNOWN)
+		return false;
+	// symlinks to directories are not followed so that cycles are impossible
+	struct stat st;
+	return !fstatat(dfd, dp->d_name, &st, AT_SYMLINK_NOFOLLOW) && S_ISDIR(st.st_mode);
+}
+
+static bool is_desktop_file_name(std::string_view filename)
+{ return !filename.starts_with('.') && filename.ends_with(desktop_file_extension); }
+
+// opening a FIFO would block
+static bool may_be_desktop_file(const struct dirent *dp)
+{
+	return (dp->d_type == DT_REG || dp->d_type == DT_LNK || dp->d_type == DT_UNKNOWN)
+	       && is_desktop_file_name(dp->d_name);
 }
 
 // In this implementation, it is assumed that either the desktop file ID or
 // the StartupWMClass key are the WM class. If a desktop file ID of one file
 // is the same as the value of the StartupWMClass key in some other file,
 // the behavior is undefined.
+//
+// Directories are listed and desktop files are parsed on a small pool of
+// threads. Large directories are split into batches so that a single
+// /usr/share/applications does not serialize the scan. The results are
+// merged afterwards in precedence order, so the outcome does not depend on
+// scheduling.
 void AppInfoLoader::scan()
 {
-	static const auto                 app_dirs = get_xdg_app_dirs();
+	app_dirs = get_xdg_app_dirs();
+
+	auto cache = IndexCache::open();
+
+	struct ScanDir {
+		DirIndex index;
+		DirInfo  info;
+		DIR     *dirp;
+		bool     cached;
+	};
+
+	// guarded by scan_mtx; deques so that references stay valid while growing
+	std::deque<ScanDir>     dirs;
+	std::deque<ScanTask>    tasks;
+	size_t                  num_unfinished = 0;
+	bool                    cache_hit      = true;
+	std::mutex              scan_mtx;
+	std::condition_variable scan_cv;
+
+	auto add_dir = [&](std::string_view path, DirInfo info) {
+		dirs.push_back({
+		    .index  = {.path = path, .mtime_ns = -1, .subdirs = {}, .entries = {}},
+		    .info   = info,
+		    .dirp   = nullptr,
+		    .cached = false,
+		});
+		tasks.push_back({.dir_idx = static_cast<uint32_t>(dirs.size() - 1), .filenames = {}});
+		num_unfinished++;
+	};
+
+	for (const auto &[i, dir] : app_dirs.dirs | std::views::enumerate) {
+		add_dir(dir, {.app_dir = static_cast<uint32_t>(i), .depth = 0, .id_prefix = "", .wd = -1});
+	}
+
+	auto list_dir = [&](uint32_t dir_idx, llvm::StringSaver &saver) {
+		std::string_view path;
+		{
+			std::lock_guard lk(scan_mtx);
+			path = dirs[dir_idx].index.path;
+		}
+
+		// watch before listing so that no change is missed
+		int wd = inotify_add_watch(inotify_fd, path.data(), watch_mask);
+		// stat before listing so that changes made during the scan invalidate
+		// the entry written to the cache
+		auto mtime_ns = get_mtime_ns(path.data());
+		auto cached   = cache.find(path, mtime_ns);
+
+		DIR                          *dirp = nullptr;
+		std::vector<std::string_view> subdirs;
+		std::vector<std::string>      filenames;
+		if (cached) {
+			subdirs = std::move(cached->subdirs);
+		} else if (mtime_ns >= 0 && (dirp = opendir(path.data()))) {
+			int dfd = dirfd(dirp);
+			while (struct dirent *dp = readdir(dirp)) {
+				if (dp->d_name[0] == '.')
+					continue;
+				if (is_subdir(dfd, dp))
+					subdirs.push_back(saver.save(dp->d_name));
+				else if (may_be_desktop_file(dp))
+					filenames.emplace_back(dp->d_name);
+			}
+		}
+
+		{
+			std::lock_guard lk(scan_mtx);
+			auto           &dir = dirs[dir_idx];
+			dir.index.mtime_ns  = mtime_ns;
+			dir.dirp            = dirp;
+			if (wd != -1) {
+				dir.info.wd = wd;
+				watch_to_dir.emplace(wd, dir_idx);
+			}
+			if (cached) {
+				dir.index.entries = std::move(cached->entries);
+				dir.cached        = true;
+			} else if (mtime_ns >= 0) {
+				cache_hit = false;
+			}
+			dir.index.subdirs = subdirs;
+
+			auto info = dir.info;
+			if (info.depth < max_scan_depth) {
+				for (auto subdir : subdirs) {
+					auto subdir_path =
+					    string_saver.save(llvm::Twine{llvm::StringRef{path}} + subdir + "/");
+					auto id_prefix = string_saver.save(
+					    llvm::Twine{llvm::StringRef{info.id_prefix}} + subdir + "-"
+					);
+					add_dir(
+					    subdir_path,
+					    {.app_dir   = info.app_dir,
+					     .depth     = info.depth + 1,
+					     .id_prefix = id_prefix,
+					     .wd        = -1}
+					);
+				}
+			}
+
+			for (auto batch : filenames | std::views::chunk(scan_batch_size)) {
+				tasks.push_back({
+				    .dir_idx   = dir_idx,
+				    .filenames = {std::make_move_iterator(batch.begin()),
+				                  std::make_move_iterator(batch.end())},
+				});
+				num_unfinished++;
+			}
+		}
+		scan_cv.notify_all();
+	};
+
+	auto parse_files = [&](const ScanTask &task, llvm::StringSaver &saver, BatchReader &reader) {
+		std::string_view path, id_prefix;
+		int              dfd;
+		{
+			std::lock_guard lk(scan_mtx);
+			const auto     &dir = dirs[task.dir_idx];
+			path                = dir.index.path;
+			id_prefix           = dir.info.id_prefix;
+			dfd                 = dirfd(dir.dirp);
+		}
+
+		auto files = reader.read(dfd, task.filenames);
+
+		std::vector<DesktopEntry> entries;
+		entries.reserve(task.filenames.size());
+		for (const auto &[filename, file] : std::views::zip(task.filenames, files)) {
+			const auto &[buffer, size] = file;
+			if (auto entry = make_entry(saver, path, id_prefix, filename, buffer.get(), size))
+				entries.push_back(*entry);
+		}
+
+		std::lock_guard lk(scan_mtx);
+		dirs[task.dir_idx].index.entries.append_range(entries);
+	};
+
+	auto work = [&] {
+		llvm::BumpPtrAllocator alloc;
+		llvm::StringSaver      saver(alloc);
+		BatchReader            reader;
+		while (true) {
+			ScanTask task;
+			{
+				std::unique_lock lk(scan_mtx);
+				scan_cv.wait(lk, [&] { return !tasks.empty() || !num_unfinished; });
+				if (tasks.empty())
+					break;
+				task = std::move(tasks.front());
+				tasks.pop_front();
+			}
+			if (task.filenames.empty())
+				list_dir(task.dir_idx, saver);
+			else
+				parse_files(task, saver, reader);
+			{
+				std::lock_guard lk(scan_mtx);
+				if (!--num_unfinished)
+					scan_cv.notify_all();
+			}
+		}
+		std::lock_guard lk(scan_mtx);
+		scan_allocs.push_back(std::move(alloc));
+	};
+
+	{
+		auto num_threads = std::clamp(std::thread::hardware_concurrency(), 1u, max_scan_threads);
+		std::vector<std::jthread> pool;
+		pool.reserve(num_threads - 1);
+		for (unsigned i = 1; i < num_threads; i++)
+			pool.emplace_back(work);
+		work();
+	}
+
+	dir_indices.reserve(dirs.size());
+	dir_infos.reserve(dirs.size());
+	for (auto &dir : dirs) {
+		if (dir.dirp)
+			closedir(dir.dirp);
+		dir_indices.push_back(std::move(dir.index));
+		dir_infos.push_back(dir.info);
+	}
+	sort_dir_order();
+
+	size_t num_entries = 0;
+	for (const auto &index : dir_indices)
+		num_entries += index.entries.size();
+	app_id_to_record.reserve(num_entries);
+	id_to_entries.reserve(num_entries);
+	for (const auto &[i, index] : dir_indices | std::views::enumerate) {
+		for (const auto &[j, entry] : index.entries | std::views::enumerate) {
+			id_to_entries[entry.desktop_file_id].push_back({
+			    .dir_idx   = static_cast<uint32_t>(i),
+			    .entry_idx = static_cast<uint32_t>(j),
+			});
+		}
+	}
+
 	// Spec:
 	// > If multiple files have the same desktop file ID, the first one in the
 	// > $XDG_DATA_DIRS precedence order is used.
-	absl::flat_hash_set<std::string>  used_desktop_file_ids;
-	static constexpr std::string_view extension = ".desktop";
-	for (const char *dir : app_dirs.dirs) {
-		DIR *dirp = opendir(dir);
-		if (!dirp)
-			continue;
+	for (auto i : dir_order) {
+		for (const auto &entry : dir_indices[i].entries) {
+			if (!app_id_to_record.contains(entry.desktop_file_id))
+				add_aliases(entry);
+		}
+	}
 
-		auto path_len = std::strlen(dir);
+	freeze_app_ids();
 
-		int dfd = dirfd(dirp);
+	if (!cache_hit)
+		IndexCache::write(dir_indices);
+	// strings of cached entries point into the mapping
+	index_cache = std::move(cache);
 
-		while (struct dirent *dp = readdir(dirp)) {
-			if (dp->d_name[0] == '.'
-			    && (dp->d_name[1] == '\0' || (dp->d_name[1] == '.' && dp->d_name[2] == '\0'))) {
+	scan_finished_flag = true;
+	if (scan_event_fd != -1) [[likely]] {
+		uint64_t one = 1;
+		auto     _   = write(scan_event_fd, &one, sizeof(one));
+	}
+}
+
+// Within an app dir, shallower paths come first, then lexicographic order.
+void AppInfoLoader::sort_dir_order()
+{
+	dir_order.resize(dir_indices.size());
+	std::iota(dir_order.begin(), dir_order.end(), 0);
+	std::ranges::sort(dir_order, {}, [this](uint32_t i) {
+		return std::tuple{dir_infos[i].app_dir, dir_infos[i].depth, dir_indices[i].path};
+	});
+	dir_ranks.resize(dir_order.size());
+	for (const auto &[rank, i] : dir_order | std::views::enumerate)
+		dir_ranks[i] = static_cast<uint32_t>(rank);
+}
+
+std::optional<DesktopEntry> AppInfoLoader::read_entry(
+    llvm::StringSaver &saver,
+    int                dfd,
+    std::string_view   dir,
+    std::string_view   id_prefix,
+    std::string_view   filename
+)
+{
+	if (!is_desktop_file_name(filename))
+		return std::nullopt;
+
+	// filename comes from a dirent, an inotify event or a std::string, all
+	// null-terminated
+	int filefd = openat(dfd, filename.data(), O_RDONLY | O_CLOEXEC);
+	if (filefd == -1)
+		return std::nullopt;
+
+	auto [buffer, size] = read_desktop_file(filefd);
+	close(filefd);
+
+	return make_entry(saver, dir, id_prefix, filename, buffer.get(), size);
+}
+
+// All strings in the returned entry are null-terminated since app IDs are
+// handed out as `const char *`.
+std::optional<DesktopEntry> AppInfoLoader::make_entry(
+    llvm::StringSaver &saver,
+    std::string_view   dir,
+    std::string_view   id_prefix,
+    std::string_view   filename,
+    const char        *buffer,
+    int                size
+)
+{
+	if (!buffer || !is_desktop_file_name(filename)) [[unlikely]]
+		return std::nullopt;
+
+	auto stem = filename;
+	stem.remove_suffix(desktop_file_extension.length());
+
+	auto entries = get_desktop_file_info(buffer, size);
+
+	auto name = entries.name.empty() ? llvm::StringRef{}
+	                                 : saver.save(llvm::StringRef{entries.name});
+
+	auto startup_wm_class = entries.startup_wm_class.empty()
+	                            ? llvm::StringRef{}
+	                            : saver.save(llvm::StringRef{entries.startup_wm_class});
+
+	auto iconstring = entries.iconstring.empty()
+	                      ? nullptr
+	                      : saver.save(llvm::StringRef{entries.iconstring}).data();
+
+	auto desktop_file_path =
+	    saver.save(llvm::Twine{llvm::StringRef{dir}} + filename).data(); // dir has trailing '/'
+
+	// Spec:
+	// > [the desktop file ID] is the path of the desktop file relative to the
+	// > $XDG_DATA_DIRS component's applications directory, with '/' replaced
+	// > by '-'.
+	auto desktop_file_id = saver.save(llvm::Twine{llvm::StringRef{id_prefix}} + stem);
+
+	return DesktopEntry{
+	    .desktop_file_id   = desktop_file_id,
+	    .startup_wm_class  = startup_wm_class,
+	    .name              = name,
+	    .iconstring        = iconstring,
+	    .desktop_file_path = desktop_file_path,
+	};
+}
+
+uint32_t AppRecords::add(const DesktopEntry &entry)
+{
+	if (!free_records.empty()) {
+		auto record = free_records.back();
+		free_records.pop_back();
+		names[record]              = entry.name.data();
+		name_lengths[record]       = static_cast<uint32_t>(entry.name.length());
+		iconstrings[record]        = entry.iconstring;
+		desktop_file_paths[record] = entry.desktop_file_path;
+		icon_paths[record]         = nullptr;
+		icon_resolved[record]      = false;
+		return record;
+	}
+
+	names.push_back(entry.name.data());
+	name_lengths.push_back(static_cast<uint32_t>(entry.name.length()));
+	iconstrings.push_back(entry.iconstring);
+	desktop_file_paths.push_back(entry.desktop_file_path);
+	icon_paths.push_back(nullptr);
+	icon_resolved.push_back(false);
+	return static_cast<uint32_t>(names.size() - 1);
+}
+
+void AppRecords::remove(uint32_t record)
+{
+	// the strings belong to the entry, not the record
+	desktop_file_paths[record] = nullptr;
+	free_records.push_back(record);
+}
+
+void AppInfoLoader::add_aliases(const DesktopEntry &entry)
+{
+	auto record = records.add(entry);
+
+	// Thunderbird's desktop file has ID org.mozilla.Thunderbird
+	// (which matches its initial class) but StartupWMClass is
+	// thunderbird.
+	bool claimed = app_id_to_record.try_emplace(entry.desktop_file_id, record).second;
+	if (!entry.startup_wm_class.empty() && entry.startup_wm_class != entry.desktop_file_id) {
+		// For JetBrains software, StartupWMClass matches initial class.
+		claimed |= app_id_to_record.try_emplace(entry.startup_wm_class, record).second;
+	}
+
+	if (!claimed) [[unlikely]]
+		records.remove(record);
+}
+
+void AppInfoLoader::remove_aliases(const DesktopEntry &entry)
+{
+	std::optional<uint32_t> record;
+
+	// an alias may have been claimed by some other desktop file
+	auto remove = [this, &entry, &record](std::string_view app_id) {
+		if (auto it = app_id_to_record.find(app_id);
+		    it != app_id_to_record.end()
+		    && records.desktop_file_paths[it->second] == entry.desktop_file_path) {
+			record = it->second;
+			app_id_to_record.erase(it);
+		}
+	};
+	remove(entry.desktop_file_id);
+	if (!entry.startup_wm_class.empty())
+		remove(entry.startup_wm_class);
+
+	// no other alias can point to it
+	if (record)
+		records.remove(*record);
+}
+
+std::optional<DesktopEntry> AppInfoLoader::find_winner(std::string_view desktop_file_id) const
+{
+	auto it = id_to_entries.find(desktop_file_id);
+	if (it == id_to_entries.end())
+		return std::nullopt;
+	auto ref =
+	    std::ranges::min(it->second, {}, [this](EntryRef r) { return dir_ranks[r.dir_idx]; });
+	return dir_indices[ref.dir_idx].entries[ref.entry_idx];
+}
+
+void AppInfoLoader::add_entry(uint32_t dir_idx, const DesktopEntry &entry)
+{
+	auto &entries = dir_indices[dir_idx].entries;
+	id_to_entries[entry.desktop_file_id].push_back({
+	    .dir_idx   = dir_idx,
+	    .entry_idx = static_cast<uint32_t>(entries.size()),
+	});
+	entries.push_back(entry);
+}
+
+void AppInfoLoader::remove_entry(uint32_t dir_idx, std::string_view desktop_file_id)
+{
+	auto it = id_to_entries.find(desktop_file_id);
+	if (it == id_to_entries.end())
+		return;
+	auto &refs = it->second;
+	auto  ref  = std::ranges::find(refs, dir_idx, &EntryRef::dir_idx);
+	if (ref == refs.end())
+		return;
+
+	auto idx = ref->entry_idx;
+	*ref     = refs.back();
+	refs.pop_back();
+	if (refs.empty())
+		id_to_entries.erase(it);
+
+	auto &entries = dir_indices[dir_idx].entries;
+	if (idx != entries.size() - 1) {
+		entries[idx] = entries.back();
+		// the ref of the moved entry follows it
+		auto &moved_refs = id_to_entries.find(entries[idx].desktop_file_id)->second;
+		auto  moved      = std::ranges::find(moved_refs, dir_idx, &EntryRef::dir_idx);
+		moved->entry_idx = idx;
+	}
+	entries.pop_back();
+}
+
+int AppInfoLoader::watch_fd() const { return inotify_fd; }
+
+bool AppInfoLoader::process_watch_events()
+{
+	alignas(inotify_event) char buf[4096];
+	while (true) {
+		auto len = read(inotify_fd, buf, sizeof(buf));
+		if (len <= 0) {
+			if (len == -1 && errno == EINTR) [[unlikely]]
+				continue;
+			break;
+		}
+		for (char *ptr = buf; ptr < buf + len;) {
+			const auto *event  = reinterpret_cast<const inotify_event *>(ptr);
+			ptr               += sizeof(inotify_event) + event->len;
+			if (event->mask & IN_Q_OVERFLOW) [[unlikely]] {
+				watch_overflowed = true;
 				continue;
 			}
-
-			if (dp->d_type != DT_REG && dp->d_type != DT_LNK && dp->d_type != DT_UNKNOWN)
+			if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) [[unlikely]] {
+				pending_events.push_back({.wd = event->wd, .mask = event->mask, .name = {}});
 				continue;
+			}
+			if (event->len) {
+				pending_events.push_back({
+				    .wd   = event->wd,
+				    .mask = event->mask,
+				    .name = std::string{event->name},
+				});
+			}
+		}
+	}
 
-			std::string_view filename(dp->d_name);
-			if (!filename.ends_with(extension))
-				continue;
+	// the maps are owned by the scanning thread until it is done
+	if (!is_available())
+		return false;
 
-			auto desktop_file_id = filename;
-			desktop_file_id.remove_suffix(extension.length());
+	return apply_pending_changes();
+}
 
-			auto [_, inserted] = used_desktop_file_ids.emplace(desktop_file_id);
-			if (!inserted)
-				continue;
+void AppInfoLoader::freeze_app_ids()
+{
+	std::vector<std::pair<std::string_view, uint32_t>> entries(
+	    app_id_to_record.begin(), app_id_to_record.end()
+	);
+	app_id_index = AppIdIndex(entries);
+}
 
-			if (int filefd = openat(dfd, dp->d_name, O_RDONLY | O_CLOEXEC); filefd != -1) {
-				auto [buffer, size] = read_desktop_file(filefd);
-				auto entries        = get_desktop_file_info(buffer.get(), size);
-				// auto app_id         = string_saver.save(
-				//     llvm::StringRef{
-				//         entries.startup_wm_class.empty() ? desktop_file_id
-				//                                          : entries.startup_wm_class
-				//     }
-				// );
-
-				auto name = entries.name.empty()
-				                ? llvm::StringRef{}
-				                : string_saver.save(llvm::StringRef{entries.name});
-
-				auto iconstring = entries.iconstring.data();
-				if (!entries.iconstring.empty()) {
-					// SAFETY: This byte is guaranteed to be '\n' before this.
-					const_cast<char *>(iconstring)[entries.iconstring.length()] = '\0';
-				}
-				auto icon_path = get_icon_path(iconstring);
-
-				auto desktop_file_path =
-				    string_saver.save(llvm::Twine{llvm::StringRef{dir, path_len}} + filename)
-				        .data(); // dir has trailing '/'
-
-				// Thunderbird's desktop file has ID org.mozilla.Thunderbird
-				// (which matches its initial class) but StartupWMClass is
-				// thunderbird.
-				app_id_to_info_map.try_emplace(
-				    string_saver.save(llvm::StringRef{desktop_file_id}),
-				    name,
-				    icon_path,
-				    desktop_file_path,
-				    std::chrono::system_clock::now()
-				);
-				if (!entries.startup_wm_class.empty()
-				    && entries.startup_wm_class != desktop_file_id) {
-					// For JetBrains software, StartupWMClass matches initial class.
-					app_id_to_info_map.try_emplace(
-					    string_saver.save(llvm::StringRef{entries.startup_wm_class}),
-					    name,
-					    icon_path,
-					    desktop_file_path,
-					    std::chrono::system_clock::now()
-					);
-				}
-				close(filefd);
+bool AppInfoLoader::apply_pending_changes()
+{
+	if (watch_overflowed) [[unlikely]] {
+		watch_overflowed = false;
+		pending_events.clear();
+		bool changed = false;
+		// subdirectories found by the resync are synced when they are added
+		for (size_t i = 0, n = dir_indices.size(); i < n; i++) {
+			if (dir_infos[i].wd != -1 || !dir_infos[i].depth)
+				changed |= resync_dir(i);
+		}
+		for (const auto &[_, waiting] : std::exchange(ancestor_watches, {})) {
+			for (auto i : waiting)
+				changed |= watch_app_dir(i);
+		}
+		if (changed)
+			freeze_app_ids();
+		return changed;
+	}
+
+	absl::flat_hash_set<std::pair<size_t, std::string>> changes;
+	absl::flat_hash_set<std::pair<size_t, std::string>> new_subdirs;
+	absl::flat_hash_set<size_t>                         removed_dirs;
+	absl::flat_hash_set<int>                            changed_ancestors;
+	for (auto &event : pending_events) {
+		// files come and go in $HOME all the time
+		if (event.mask & (IN_ISDIR | IN_DELETE_SELF | IN_MOVE_SELF)
+		    && ancestor_watches.contains(event.wd)) {
+			changed_ancestors.insert(event.wd);
+		}
+		auto it = watch_to_dir.find(event.wd);
+		if (it == watch_to_dir.end()) [[unlikely]]
+			continue;
+		if (event.mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+			removed_dirs.insert(it->second);
+		else if (!(event.mask & IN_ISDIR))
+			changes.emplace(it->second, std::move(event.name));
+		else if (event.mask & (IN_CREATE | IN_MOVED_TO))
+			new_subdirs.emplace(it->second, std::move(event.name));
+		// a subdirectory that is deleted or moved away reports that itself
+	}
+	pending_events.clear();
+
+	// removals before additions, in case a directory was replaced
+	bool changed = false;
+	for (const auto &[i, name] : changes)
+		changed |= apply_change(i, name);
+	for (auto i : removed_dirs) {
+		changed |= remove_dir(i);
+		if (!dir_infos[i].depth)
+			changed |= watch_app_dir(i);
+	}
+	for (const auto &[i, name] : new_subdirs)
+		changed |= add_subdir(i, name);
+	for (auto wd : changed_ancestors) {
+		auto waiting = ancestor_watches.extract(wd);
+		if (!watch_to_dir.contains(wd))
+			inotify_rm_watch(inotify_fd, wd);
+		// watches the ancestor again if the app dir is still missing
+		for (auto i : waiting.mapped())
+			changed |= watch_app_dir(i);
+	}
+	if (changed)
+		freeze_app_ids();
+	return changed;
+}
+
+void AppInfoLoader::watch_missing_app_dirs()
+{
+	bool changed = false;
+	for (size_t i = 0; i < dir_infos.size(); i++) {
+		if (!dir_infos[i].depth && dir_infos[i].wd == -1)
+			changed |= watch_app_dir(i);
+	}
+	if (changed)
+		freeze_app_ids();
+}
+
+// App dirs that do not exist yet are common: ~/.local/share/applications on
+// a fresh account, flatpak's exports before the first install. Their nearest
+// existing ancestor is watched instead, and this runs again when a directory
+// appears there.
+bool AppInfoLoader::watch_app_dir(size_t dir_idx)
+{
+	if (dir_infos[dir_idx].wd != -1)
+		return false;
+
+	auto path = dir_indices[dir_idx].path;
+	// only retried while directories keep appearing under our feet
+	for (uint32_t retry = 0; retry < max_scan_depth; retry++) {
+		if (int wd = inotify_add_watch(inotify_fd, path.data(), watch_mask); wd != -1) {
+			dir_infos[dir_idx].wd         = wd;
+			watch_to_dir[wd]              = dir_idx;
+			dir_indices[dir_idx].mtime_ns = get_mtime_ns(path.data());
+			return resync_dir(dir_idx);
+		}
+		if (errno != ENOENT) [[unlikely]]
+			return false;
+
+		std::string ancestor(path); // has a trailing '/'
+		std::string child;
+		int         wd = -1;
+		while (wd == -1) {
+			ancestor.pop_back();
+			auto slash = ancestor.rfind('/');
+			if (slash == std::string::npos)
+				return false;
+			child = ancestor;
+			ancestor.resize(slash + 1);
+			wd = inotify_add_watch(inotify_fd, ancestor.c_str(), ancestor_watch_mask);
+			if (wd == -1 && errno != ENOENT) [[unlikely]]
+				return false;
+		}
+		auto &waiting = ancestor_watches[wd];
+		if (!std::ranges::contains(waiting, dir_idx))
+			waiting.push_back(dir_idx);
+
+		// created before the watch was added
+		if (access(child.c_str(), F_OK))
+			return false;
+	}
+	return false;
+}
+
+/// Whether `a` and `b` would give the same app info.
+static bool is_same_app(const DesktopEntry &a, const DesktopEntry &b)
+{
+	auto str = [](const char *s) { return std::string_view{s ? s : ""}; };
+	return str(a.desktop_file_path) == str(b.desktop_file_path) && a.name == b.name
+	    && a.startup_wm_class == b.startup_wm_class && str(a.iconstring) == str(b.iconstring)
+	    && (a.iconstring == nullptr) == (b.iconstring == nullptr);
+}
+
+// Only the changed file is re-read; precedence between directories is
+// recomputed for its desktop file ID alone.
+bool AppInfoLoader::apply_change(size_t dir_idx, std::string_view filename)
+{
+	if (!is_desktop_file_name(filename))
+		return false;
+
+	auto stem = filename;
+	stem.remove_suffix(desktop_file_extension.length());
+	auto desktop_file_id = std::format("{}{}", dir_infos[dir_idx].id_prefix, stem);
+
+	auto old_winner = find_winner(desktop_file_id);
+	remove_entry(dir_idx, desktop_file_id);
+
+	// path is null-terminated
+	auto path = dir_indices[dir_idx].path;
+	if (int dfd = open(path.data(), O_RDONLY | O_DIRECTORY | O_CLOEXEC); dfd != -1) {
+		auto id_prefix = dir_infos[dir_idx].id_prefix;
+		if (auto entry = read_entry(string_saver, dfd, path, id_prefix, filename))
+			add_entry(dir_idx, *entry);
+		close(dfd);
+	}
+
+	auto new_winner = find_winner(desktop_file_id);
+	if (!old_winner && !new_winner)
+		return false;
+
+	// a shadowed file changed, or the winner was rewritten as it was
+	if (old_winner && new_winner && is_same_app(*old_winner, *new_winner)) {
+		// records are identified by their path pointer, which a re-read changes
+		for (auto app_id : {new_winner->desktop_file_id, new_winner->startup_wm_class}) {
+			auto it = app_id_to_record.find(app_id);
+			if (it != app_id_to_record.end()
+			    && records.desktop_file_paths[it->second] == old_winner->desktop_file_path) {
+				records.desktop_file_paths[it->second] = new_winner->desktop_file_path;
 			}
 		}
+		return false;
+	}
+
+	if (old_winner)
+		remove_aliases(*old_winner);
+	if (new_winner)
+		add_aliases(*new_winner);
+	return true;
+}
+
+bool AppInfoLoader::resync_dir(size_t dir_idx)
+{
+	auto id_prefix = dir_infos[dir_idx].id_prefix;
+
+	absl::flat_hash_set<std::string> filenames;
+	std::vector<std::string>         subdirs;
+	for (const auto &entry : dir_indices[dir_idx].entries) {
+		filenames.emplace(
+		    std::format("{}.desktop", entry.desktop_file_id.substr(id_prefix.length()))
+		);
+	}
+	if (DIR *dirp = opendir(dir_indices[dir_idx].path.data())) {
+		while (struct dirent *dp = readdir(dirp)) {
+			if (is_subdir(dirfd(dirp), dp))
+				subdirs.emplace_back(dp->d_name);
+			else
+				filenames.emplace(dp->d_name);
+		}
 		closedir(dirp);
 	}
-	scan_finished_flag = true;
+
+	bool changed = false;
+	for (const auto &filename : filenames)
+		changed |= apply_change(dir_idx, filename);
+	for (const auto &subdir : subdirs)
+		changed |= add_subdir(dir_idx, subdir);
+	return changed;
+}
+
+bool AppInfoLoader::add_subdir(size_t parent_idx, std::string_view name)
+{
+	// copied since the vectors may grow below
+	auto parent_info = dir_infos[parent_idx];
+	auto parent_path = dir_indices[parent_idx].path;
+	if (name.starts_with('.') || parent_info.depth >= max_scan_depth)
+		return false;
+
+	auto path_str = std::format("{}{}/", parent_path, name);
+	auto it       = std::ranges::find(dir_indices, std::string_view{path_str}, &DirIndex::path);
+	auto dir_idx  = static_cast<size_t>(it - dir_indices.begin());
+	if (it == dir_indices.end()) {
+		auto path      = string_saver.save(path_str);
+		auto id_prefix = string_saver.save(
+		    llvm::Twine{llvm::StringRef{parent_info.id_prefix}} + llvm::StringRef{name} + "-"
+		);
+		dir_indices.push_back({.path = path, .mtime_ns = -1, .subdirs = {}, .entries = {}});
+		dir_infos.push_back({
+		    .app_dir   = parent_info.app_dir,
+		    .depth     = parent_info.depth + 1,
+		    .id_prefix = id_prefix,
+		    .wd        = -1,
+		});
+		dir_indices[parent_idx].subdirs.push_back(string_saver.save(llvm::StringRef{name}));
+		sort_dir_order();
+	} else if (dir_infos[dir_idx].wd != -1) {
+		// already watched, e.g. found again by a resync
+		return false;
+	}
+
+	auto path = dir_indices[dir_idx].path;
+	if (int wd = inotify_add_watch(inotify_fd, path.data(), watch_mask); wd != -1) {
+		dir_infos[dir_idx].wd = wd;
+		watch_to_dir[wd]      = dir_idx;
+	}
+	dir_indices[dir_idx].mtime_ns = get_mtime_ns(path.data());
+
+	return resync_dir(dir_idx);
+}
+
+// Also removes the subdirectories, which may still be watched if the
+// directory was moved rather than deleted.
+bool AppInfoLoader::remove_dir(size_t dir_idx)
+{
+	auto path    = dir_indices[dir_idx].path;
+	bool changed = false;
+	for (size_t i = 0; i < dir_indices.size(); i++) {
+		if (!dir_indices[i].path.starts_with(path))
+			continue;
+		if (int wd = std::exchange(dir_infos[i].wd, -1); wd != -1) {
+			inotify_rm_watch(inotify_fd, wd);
+			watch_to_dir.erase(wd);
+		}
+		dir_indices[i].mtime_ns = -1;
+
+		// the directory no longer exists at its path, so every entry goes
+		auto &entries = dir_indices[i].entries;
+		while (!entries.empty()) {
+			auto entry      = entries.back();
+			auto old_winner = find_winner(entry.desktop_file_id);
+			remove_entry(i, entry.desktop_file_id);
+			if (old_winner && old_winner->desktop_file_path == entry.desktop_file_path) {
+				remove_aliases(entry);
+				if (auto new_winner = find_winner(entry.desktop_file_id))
+					add_aliases(*new_winner);
+				changed = true;
+			}
+		}
+	}
+	return changed;
 }
 
-const char *AppInfoLoader::get_icon_path(const char *iconstring)
+std::optional<const char *> AppInfoLoader::get_icon_path(const char *iconstring)
 {
 	if (!iconstring) [[unlikely]]
 		return nullptr;
 
 	if (iconstring[0] == '/')
-		return string_saver.save(iconstring).data();
+		return intern_icon_path(iconstring);
 
-	auto *raw_path = nk_xdg_theme_get_icon(
-	    theme_context, icon_themes.data(), "Applications", iconstring, icon_size, 1, 1
-	);
-	if (!raw_path) [[unlikely]]
+	if (!icon_theme_index) [[unlikely]] {
+		std::lock_guard lk(mtx);
+		if (!loaded_icon_themes) {
+			icon_lookups_waiting = true;
+			return std::nullopt;
+		}
+		icon_theme_index = std::move(loaded_icon_themes);
+	}
+
+	if (auto path = icon_theme_index->find_icon(iconstring); !path.empty()) [[likely]]
+		return intern_icon_path(path);
+
+	// pixmaps outside the data dirs, themes only GSettings knows about, ...
+	std::string fallback;
+	{
+		std::lock_guard lk(mtx);
+		if (auto it = fallback_paths.find(iconstring); it != fallback_paths.end()) {
+			fallback = it->second;
+		} else {
+			if (!std::ranges::contains(fallback_queue, iconstring))
+				fallback_queue.push_back(iconstring);
+			icon_lookups_waiting = true;
+			cv.notify_one();
+			return std::nullopt;
+		}
+	}
+	if (fallback.empty()) [[unlikely]]
 		return nullptr;
-	auto path = string_saver.save(raw_path).data();
-	g_free(raw_path);
-	return path;
+	return intern_icon_path(fallback);
+}
+
+void AppInfoLoader::resolve_fallback(std::unique_lock<std::mutex> &lk)
+{
+	const char *iconstring = fallback_queue.back();
+	fallback_queue.pop_back();
+	auto generation = fallback_generation;
+	lk.unlock();
+
+	std::string path;
+	{
+		std::lock_guard nk_lk(nk_mtx);
+		auto *raw_path = nk_xdg_theme_get_icon(
+		    theme_context, icon_themes.data(), "Applications", iconstring, icon_size, 1, 1
+		);
+		if (raw_path) {
+			path = raw_path;
+			g_free(raw_path);
+		}
+	}
+
+	lk.lock();
+	if (generation != fallback_generation) [[unlikely]]
+		return;
+	fallback_paths.emplace(iconstring, std::move(path));
+	wake_icon_lookups();
+}
+
+void AppInfoLoader::wake_icon_lookups()
+{
+	if (!icon_lookups_waiting || icon_event_fd == -1)
+		return;
+	icon_lookups_waiting = false;
+	uint64_t one         = 1;
+	auto     _           = write(icon_event_fd, &one, sizeof(one));
 }
 
+const char *AppInfoLoader::intern_icon_path(std::string_view path)
+{
+	if (auto it = icon_path_set.find(path); it != icon_path_set.end())
+		return it->data();
+	std::string_view saved = string_saver.save(path);
+	icon_path_set.insert(saved);
+	return saved.data();
+}
 
 AppInfo AppInfoLoader::get_app_info(std::string_view app_id) const
 {
-	if (auto it = app_id_to_info_map.find(app_id); it != app_id_to_info_map.end()) [[likely]]
-		return AppInfo{.app_id = it->first.data(), .name = it->second.name};
+	if (auto [key, record] = app_id_index.find(app_id); key) [[likely]]
+		return AppInfo{.app_id = key, .name = records.name(record)};
 	return AppInfo{.app_id = nullptr, .name = std::string_view{}};
 }
 
-std::optional<std::future<Image>> AppInfoLoader::get_app_icon(std::string_view app_id) const
+// Icons are resolved against the themes here rather than in `scan()`: most
+// apps never have a window, and theme lookups dominate the scan otherwise.
+std::optional<const char *> AppInfoLoader::get_app_icon_path(std::string_view app_id)
 {
-	std::string_view name;
-	const char      *icon_path;
+	auto [key, record] = app_id_index.find(app_id);
+	if (!key) [[unlikely]]
+		return nullptr;
 
-	if (auto it = app_id_to_info_map.find(app_id); it != app_id_to_info_map.end()) [[likely]] {
-		name      = it->second.name;
-		icon_path = it->second.icon_path;
-		if (!icon_path) [[unlikely]]
-			return {};
-	} else {
-		return {};
+	if (!records.icon_resolved[record]) [[unlikely]] {
+		auto path = get_icon_path(records.iconstring(record));
+		if (!path)
+			return std::nullopt;
+		records.icon_paths[record]    = *path;
+		records.icon_resolved[record] = true;
 	}
+	return records.icon_paths[record];
+}
 
-	std::promise<Image> promise;
-	auto                ret = promise.get_future();
+std::shared_future<Image> AppInfoLoader::load_icon(const char *icon_path, uint32_t priority)
+{
+	std::shared_future<Image> ret;
 	{
 		std::lock_guard lk(mtx);
-		task_queue.emplace(icon_path, std::move(promise));
+		// the queue only holds the icons of open apps, see `decode_thread`
+		if (auto it = std::ranges::find(task_queue, icon_path, &Task::icon_path);
+		    it != task_queue.end()) {
+			it->priority = std::min(it->priority, priority);
+			return it->future;
+		}
+		if (auto it = std::ranges::find(
+		        decoding_tasks, icon_path, [](const Task *t) { return t->icon_path; }
+		    );
+		    it != decoding_tasks.end()) {
+			return (*it)->future;
+		}
+
+		std::promise<Image> promise;
+		ret = promise.get_future().share();
+		task_queue.push_back({
+		    .icon_path = icon_path,
+		    .priority  = priority,
+		    .seq       = next_task_seq++,
+		    .icon_size = icon_size,
+		    .promise   = std::move(promise),
+		    .future    = ret,
+		});
 	}
 	cv.notify_one();
 
 	return ret;
 }
 
+void AppInfoLoader::cancel_icon(const char *icon_path)
+{
+	std::lock_guard lk(mtx);
+	if (auto it = std::ranges::find(task_queue, icon_path, &Task::icon_path);
+	    it != task_queue.end()) {
+		if (it != task_queue.end() - 1)
+			*it = std::move(task_queue.back());
+		task_queue.pop_back();
+	}
+}
+
+std::optional<std::shared_future<Image>>
+AppInfoLoader::get_app_icon(std::string_view app_id, uint32_t priority)
+{
+	if (auto icon_path = get_app_icon_path(app_id); icon_path && *icon_path) [[likely]]
+		return load_icon(*icon_path, priority);
+	return {};
+}
+
+int AppInfoLoader::ready_icons_fd() const { return icon_event_fd; }
+
+int AppInfoLoader::scan_finished_fd() const { return scan_event_fd; }
+
+std::vector<const char *> AppInfoLoader::take_ready_icons()
+{
+	std::vector<const char *> icon_paths;
+	std::lock_guard           lk(mtx);
+	uint64_t                  count;
+	auto                      _ = read(icon_event_fd, &count, sizeof(count));
+	icon_paths.swap(ready_icons);
+	return icon_paths;
+}
+
+void AppInfoLoader::prioritize_icons(std::span<const char *const> app_ids)
+{
+	absl::flat_hash_map<const char *, uint32_t> path_priorities;
+	path_priorities.reserve(app_ids.size());
+	for (const auto &[i, app_id] : app_ids | std::views::enumerate) {
+		auto [key, record] = app_id_index.find(app_id);
+		// unresolved icons can't have a task
+		if (key && records.icon_resolved[record] && records.icon_paths[record])
+			path_priorities.try_emplace(records.icon_paths[record], static_cast<uint32_t>(i));
+	}
+
+	std::lock_guard lk(mtx);
+	for (auto &task : task_queue) {
+		if (auto it = path_priorities.find(task.icon_path); it != path_priorities.end())
+			task.priority = it->second;
+	}
+}
+
 [[nodiscard]] bool AppInfoLoader::is_available()
 {
 	if (!worker_processing_tasks) [[unlikely]] {
 		if (scan_finished_flag) {
 			worker_processing_tasks = true;
 			worker.join();
-			worker = std::thread(&AppInfoLoader::worker_thread, this);
+			start_decode_threads();
+			watch_missing_app_dirs();
+			// changes that happened while scanning; the caller has to re-resolve
+			// everything anyway
+			apply_pending_changes();
 		}
 	}
 	return worker_processing_tasks;
 }
 
-void AppInfoLoader::worker_thread()
+void AppInfoLoader::start_decode_threads()
+{
+	auto num_threads = std::clamp(std::thread::hardware_concurrency(), 1u, max_decode_threads);
+	decode_threads.reserve(num_threads);
+	for (unsigned i = 0; i < num_threads; i++)
+		decode_threads.emplace_back(&AppInfoLoader::decode_thread, this);
+}
+
+// The queue only ever holds the icons of open apps, so a linear scan for the
+// most urgent task is cheaper than keeping a heap that
+// `prioritize_icons` would have to rebuild.
+void AppInfoLoader::decode_thread()
 {
 	while (true) {
 		Task task;
 		{
 			std::unique_lock lk(mtx);
-			cv.wait(lk, [this] { return shutdown_flag || !task_queue.empty(); });
+			cv.wait(lk, [this] {
+				return shutdown_flag || !task_queue.empty() || !fallback_queue.empty();
+			});
 			if (shutdown_flag) [[unlikely]]
 				break;
-			task = std::move(task_queue.front());
-			task_queue.pop();
+			// an app waits for the path before it can queue the decode
+			if (!fallback_queue.empty()) {
+				resolve_fallback(lk);
+				continue;
+			}
+			auto it = std::ranges::min_element(task_queue, {}, [](const Task &t) {
+				return std::pair{t.priority, t.seq};
+			});
+			task = std::move(*it);
+			if (it != task_queue.end() - 1)
+				*it = std::move(task_queue.back());
+			task_queue.pop_back();
+			decoding_tasks.push_back(&task);
+		}
+		task.promise.set_value(image_cache.read(task.icon_path, task.icon_size));
+
+		std::lock_guard lk(mtx);
+		std::erase(decoding_tasks, &task);
+		if (icon_event_fd == -1) [[unlikely]]
+			continue;
+		// the main thread drains the eventfd together with the list, so only
+		// the first icon of a batch wakes it
+		if (ready_icons.empty()) {
+			uint64_t one = 1;
+			auto     _   = write(icon_event_fd, &one, sizeof(one));
 		}
-		task.promise.set_value(read_image(task.icon_path, icon_size));
+		ready_icons.push_back(task.icon_path);
 	}
 }
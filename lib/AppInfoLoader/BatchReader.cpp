@@ -0,0 +1,286 @@
+module;
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+module wm.AppInfoLoader.BatchReader;
+
+import std;
+import wm.AppInfoLoader.Xdg;
+
+using std::uint64_t;
+
+using namespace wm;
+
+#ifdef HAVE_LIBURING
+
+// one SQE per open and stat, then one per read and close
+static constexpr unsigned queue_depth = 2 * BatchReader::max_batch_size;
+
+struct BatchReader::Ring {
+	io_uring ring;
+};
+
+BatchReader::BatchReader()
+{
+	auto r = std::make_unique<Ring>();
+	if (!io_uring_queue_init(queue_depth, &r->ring, 0)) [[likely]]
+		ring = std::move(r);
+}
+
+BatchReader::~BatchReader()
+{
+	drop_ring();
+}
+
+void BatchReader::drop_ring()
+{
+	if (!ring)
+		return;
+	io_uring_queue_exit(&ring->ring);
+	ring.reset();
+}
+
+enum class Reaped {
+	all,
+	/// Not all requests were submitted or the ring failed, but every request
+	/// that was submitted has completed.
+	some,
+	/// Requests may still be in flight. Only tearing the ring down waits for
+	/// them.
+	unknown,
+};
+
+// user_data of the cancel request; batch requests use twice their index
+static constexpr uint64_t cancel_data = ~uint64_t{0};
+
+/// Cancels the `in_flight` requests and reaps their completions. Those that
+/// had already finished are passed to `on_complete` as usual, cancelled ones
+/// with -ECANCELED.
+template <typename F>
+static Reaped cancel_and_reap(io_uring *ring, int in_flight, F &on_complete)
+{
+	auto *sqe = io_uring_get_sqe(ring);
+	if (!sqe) [[unlikely]]
+		return Reaped::unknown;
+	io_uring_prep_cancel64(sqe, 0, IORING_ASYNC_CANCEL_ANY);
+	io_uring_sqe_set_data64(sqe, cancel_data);
+	// also SQEs a partial submit left behind
+	int submitted = io_uring_submit(ring);
+	if (submitted <= 0) [[unlikely]]
+		return Reaped::unknown;
+
+	for (in_flight += submitted; in_flight > 0;) {
+		io_uring_cqe *cqe;
+		int           ret = io_uring_wait_cqe(ring, &cqe);
+		if (ret == -EINTR || ret == -EAGAIN) [[unlikely]]
+			continue;
+		if (ret) [[unlikely]]
+			return Reaped::unknown;
+		if (auto data = io_uring_cqe_get_data64(cqe); data != cancel_data)
+			on_complete(data, cqe->res);
+		io_uring_cqe_seen(ring, cqe);
+		in_flight--;
+	}
+	return Reaped::some;
+}
+
+/// Submits the queued SQEs and calls `on_complete(user_data, res)` for their
+/// `count` completions. Has to wait for all of them: in-flight requests write
+/// into the caller's stack. If waiting fails, the rest are cancelled.
+template <typename F>
+static Reaped submit_and_reap(io_uring *ring, unsigned count, F &&on_complete)
+{
+	int submitted = io_uring_submit(ring);
+	if (submitted < 0) [[unlikely]]
+		return Reaped::some;
+	for (int seen = 0; seen < submitted;) {
+		io_uring_cqe *cqe;
+		int           ret = io_uring_wait_cqe(ring, &cqe);
+		if (ret) [[unlikely]] {
+			if (ret == -EINTR || ret == -EAGAIN)
+				continue;
+			return cancel_and_reap(ring, submitted - seen, on_complete);
+		}
+		on_complete(io_uring_cqe_get_data64(cqe), cqe->res);
+		io_uring_cqe_seen(ring, cqe);
+		seen++;
+	}
+	return static_cast<unsigned>(submitted) == count ? Reaped::all : Reaped::some;
+}
+
+bool BatchReader::read_batch(
+    int                                           dfd,
+    std::span<const std::string>                  filenames,
+    std::span<std::pair<unique_aligned_ptr, int>> files
+)
+{
+	auto *r = &ring->ring;
+
+	std::array<int, max_batch_size>          fds;
+	std::array<struct statx, max_batch_size> stats;
+	std::array<bool, max_batch_size>         stat_ok{};
+	std::array<bool, max_batch_size>         closing{};
+	fds.fill(-1);
+
+	// The caller reads the batch again without the ring. Nothing may be in
+	// flight when `stats` and `files` go away.
+	auto fail = [&](Reaped reaped) {
+		if (reaped == Reaped::unknown) {
+			drop_ring();
+			// a close that was not reaped may have run, and the fd may
+			// already belong to someone else; leaking it is the lesser evil
+			for (size_t i = 0; i < filenames.size(); i++) {
+				if (closing[i])
+					fds[i] = -1;
+			}
+		}
+		for (auto fd : fds | std::views::take(filenames.size())) {
+			if (fd >= 0)
+				close(fd);
+		}
+		std::ranges::fill(files, std::pair<unique_aligned_ptr, int>{});
+		return false;
+	};
+
+	for (const auto &[i, filename] : filenames | std::views::enumerate) {
+		auto *sqe = io_uring_get_sqe(r);
+		io_uring_prep_openat(sqe, dfd, filename.c_str(), O_RDONLY | O_CLOEXEC, 0);
+		io_uring_sqe_set_data64(sqe, uint64_t(i) << 1);
+
+		sqe = io_uring_get_sqe(r);
+		io_uring_prep_statx(sqe, dfd, filename.c_str(), 0, STATX_SIZE, &stats[i]);
+		io_uring_sqe_set_data64(sqe, uint64_t(i) << 1 | 1);
+	}
+	auto reaped = submit_and_reap(r, 2 * filenames.size(), [&](uint64_t data, int res) {
+		if (data & 1)
+			stat_ok[data >> 1] = !res;
+		else
+			fds[data >> 1] = res; // -errno on failure
+	});
+	if (reaped != Reaped::all) [[unlikely]]
+		return fail(reaped);
+
+	// Only a prefix is read, as in read_desktop_file. Files that fit in it are
+	// closed by a hard-linked close, which runs even if the read fails or is
+	// short; the others stay open in case the rest is needed.
+	std::array<int, max_batch_size> sizes{};
+	unsigned                        count = 0;
+	for (size_t i = 0; i < filenames.size(); i++) {
+		if (fds[i] < 0)
+			continue;
+
+		auto size = stat_ok[i] ? stats[i].stx_size : 0;
+		if (size > 0 && size <= uint64_t{max_desktop_file_size}) [[likely]] {
+			sizes[i]        = static_cast<int>(size);
+			int length      = std::min(sizes[i], desktop_file_prefix_size);
+			files[i].first  = make_desktop_file_buffer(length);
+			files[i].second = length;
+
+			auto *sqe = io_uring_get_sqe(r);
+			io_uring_prep_read(sqe, fds[i], files[i].first.get(), length, 0);
+			io_uring_sqe_set_data64(sqe, uint64_t(i) << 1);
+			count++;
+			if (length < sizes[i]) [[unlikely]]
+				continue;
+			io_uring_sqe_set_flags(sqe, IOSQE_IO_HARDLINK);
+		}
+
+		auto *sqe = io_uring_get_sqe(r);
+		io_uring_prep_close(sqe, fds[i]);
+		io_uring_sqe_set_data64(sqe, uint64_t(i) << 1 | 1);
+		closing[i] = true;
+		count++;
+	}
+	reaped = submit_and_reap(r, count, [&](uint64_t data, int res) {
+		if (data & 1) {
+			// the fd is gone even if close reports an error
+			if (res != -ECANCELED)
+				fds[data >> 1] = -1;
+			return;
+		}
+		auto &[buffer, length] = files[data >> 1];
+		if (res <= 0) [[unlikely]] {
+			buffer.reset();
+			length = 0;
+		} else if (res < length) [[unlikely]] {
+			// truncated since the statx; keep the padding contract
+			std::memset(buffer.get() + res, '\n', length - res);
+			length = res;
+		}
+	});
+	// closes that did not run are done by `fail`
+	if (reaped != Reaped::all) [[unlikely]]
+		return fail(reaped);
+
+	for (size_t i = 0; i < filenames.size(); i++) {
+		if (fds[i] < 0)
+			continue;
+		auto &[buffer, length] = files[i];
+		if (buffer && !has_complete_desktop_entry(buffer.get(), length, sizes[i])) [[unlikely]]
+			files[i] = read_desktop_file_rest(fds[i], std::move(buffer), length, sizes[i]);
+		close(fds[i]);
+	}
+	return true;
+}
+
+#else
+
+struct BatchReader::Ring {};
+
+BatchReader::BatchReader() = default;
+
+BatchReader::~BatchReader() = default;
+
+void BatchReader::drop_ring() {}
+
+bool BatchReader::read_batch(
+    int,
+    std::span<const std::string>,
+    std::span<std::pair<unique_aligned_ptr, int>>
+)
+{
+	std::unreachable();
+}
+
+#endif
+
+static void read_one_by_one(
+    int                                           dfd,
+    std::span<const std::string>                  filenames,
+    std::span<std::pair<unique_aligned_ptr, int>> files
+)
+{
+	for (const auto &[filename, file] : std::views::zip(filenames, files)) {
+		if (int fd = openat(dfd, filename.c_str(), O_RDONLY | O_CLOEXEC); fd != -1) {
+			file = read_desktop_file(fd);
+			close(fd);
+		}
+	}
+}
+
+std::vector<std::pair<unique_aligned_ptr, int>>
+BatchReader::read(int dfd, std::span<const std::string> filenames)
+{
+	std::vector<std::pair<unique_aligned_ptr, int>> files(filenames.size());
+
+	size_t first = 0;
+	for (; ring && first < filenames.size(); first += max_batch_size) {
+		auto n = std::min(max_batch_size, filenames.size() - first);
+		bool ok = read_batch(dfd, filenames.subspan(first, n), std::span{files}.subspan(first, n));
+		if (!ok) [[unlikely]] {
+			// a ring that failed once is not trusted with later batches
+			drop_ring();
+			break;
+		}
+	}
+	if (first < filenames.size()) [[unlikely]]
+		read_one_by_one(dfd, filenames.subspan(first), std::span{files}.subspan(first));
+	return files;
+}
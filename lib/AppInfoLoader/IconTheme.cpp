@@ -0,0 +1,592 @@
+module;
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+module wm.AppInfoLoader.IconTheme;
+
+import std;
+import absl;
+
+import wm.AppInfoLoader.IndexCache;
+
+using std::uint32_t, std::uint64_t, std::int64_t;
+
+using namespace wm;
+
+// icon-theme.cache layout, big-endian, offsets from the start of the file:
+//
+//   Header:    u16 major, u16 minor, u32 hash_offset, u32 dir_list_offset
+//   Hash:      u32 num_buckets, u32 icon_offset[num_buckets]
+//   Icon:      u32 chain_offset, u32 name_offset, u32 image_list_offset
+//   ImageList: u32 num_images, {u16 dir, u16 flags, u32 image_data_offset}[num_images]
+//   DirList:   u32 num_dirs, u32 name_offset[num_dirs]
+//
+// Empty buckets and chain ends are `no_offset`.
+
+static constexpr uint16_t cache_major_version = 1;
+static constexpr uint32_t no_offset           = 0xffffffff;
+
+static constexpr uint16_t has_suffix_xpm = 1 << 0;
+static constexpr uint16_t has_suffix_svg = 1 << 1;
+static constexpr uint16_t has_suffix_png = 1 << 2;
+
+static constexpr std::string_view cache_file_name = "icon-theme.cache";
+
+/// GTK's `icon_name_hash`, which hashes signed chars.
+static uint32_t icon_name_hash(std::string_view name)
+{
+	uint32_t h = 0;
+	for (signed char c : name)
+		h = (h << 5) - h + static_cast<uint32_t>(c);
+	return h;
+}
+
+namespace {
+
+/// Bounds-checked reads from a mapped cache; a corrupt cache reads as a miss.
+struct CacheReader {
+	const unsigned char *data;
+	size_t               size;
+
+	bool read16(uint64_t offset, uint16_t &out) const
+	{
+		if (offset + 2 > size) [[unlikely]]
+			return false;
+		out = static_cast<uint16_t>(data[offset] << 8 | data[offset + 1]);
+		return true;
+	}
+
+	bool read32(uint64_t offset, uint32_t &out) const
+	{
+		if (offset + 4 > size) [[unlikely]]
+			return false;
+		out = uint32_t{data[offset]} << 24
+		      | uint32_t{data[offset + 1]} << 16
+		      | uint32_t{data[offset + 2]} << 8
+		      | uint32_t{data[offset + 3]};
+		return true;
+	}
+
+	/// Empty if the string is not null-terminated within the file.
+	std::string_view string(uint32_t offset) const
+	{
+		if (offset >= size) [[unlikely]]
+			return {};
+		auto *str = reinterpret_cast<const char *>(data + offset);
+		auto *end = static_cast<const char *>(std::memchr(str, '\0', size - offset));
+		if (!end) [[unlikely]]
+			return {};
+		return {str, end};
+	}
+};
+
+} // namespace
+
+IconCache::IconCache() : mapping(nullptr), mapping_size(0) {}
+
+IconCache::IconCache(const unsigned char *mapping, size_t mapping_size) :
+    mapping(mapping),
+    mapping_size(mapping_size)
+{}
+
+IconCache::IconCache(IconCache &&other) noexcept :
+    mapping(std::exchange(other.mapping, nullptr)),
+    mapping_size(std::exchange(other.mapping_size, 0))
+{}
+
+IconCache &IconCache::operator=(IconCache &&other) noexcept
+{
+	if (this != &other) {
+		if (mapping)
+			munmap(const_cast<unsigned char *>(mapping), mapping_size);
+		mapping      = std::exchange(other.mapping, nullptr);
+		mapping_size = std::exchange(other.mapping_size, 0);
+	}
+	return *this;
+}
+
+IconCache::~IconCache()
+{
+	if (mapping)
+		munmap(const_cast<unsigned char *>(mapping), mapping_size);
+}
+
+IconCache IconCache::open(const std::string &theme_dir)
+{
+	auto path = theme_dir + std::string{cache_file_name};
+	int  fd   = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return {};
+
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size < 12) [[unlikely]] {
+		close(fd);
+		return {};
+	}
+
+	// An icon installed without running gtk-update-icon-cache bumps the
+	// directory's mtime; GTK ignores the cache then, and so do we.
+	int64_t cache_mtime = int64_t{st.st_mtim.tv_sec} * 1'000'000'000 + st.st_mtim.tv_nsec;
+	if (cache_mtime < get_mtime_ns(theme_dir.c_str())) {
+		close(fd);
+		return {};
+	}
+
+	auto  size = static_cast<size_t>(st.st_size);
+	void *ptr  = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) [[unlikely]]
+		return {};
+
+	IconCache cache(static_cast<const unsigned char *>(ptr), size);
+
+	CacheReader reader{cache.mapping, size};
+	uint16_t    major;
+	if (!reader.read16(0, major) || major != cache_major_version)
+		return {};
+
+	return cache;
+}
+
+std::vector<std::string_view> IconCache::dirs() const
+{
+	CacheReader reader{mapping, mapping_size};
+	uint32_t    list_offset, num_dirs;
+	if (!reader.read32(8, list_offset) || !reader.read32(list_offset, num_dirs)) [[unlikely]]
+		return {};
+
+	std::vector<std::string_view> names;
+	names.reserve(std::min<size_t>(num_dirs, mapping_size / 4));
+	for (uint32_t i = 0; i < num_dirs; i++) {
+		uint32_t name_offset;
+		if (!reader.read32(uint64_t{list_offset} + 4 + i * uint64_t{4}, name_offset)) [[unlikely]]
+			return {};
+		names.push_back(reader.string(name_offset));
+	}
+	return names;
+}
+
+void IconCache::find(std::string_view name, std::vector<IconImage> &images) const
+{
+	CacheReader reader{mapping, mapping_size};
+	uint32_t    hash_offset, num_buckets;
+	if (!reader.read32(4, hash_offset) || !reader.read32(hash_offset, num_buckets)) [[unlikely]]
+		return;
+	if (!num_buckets) [[unlikely]]
+		return;
+
+	uint32_t bucket = icon_name_hash(name) % num_buckets;
+	uint32_t icon_offset;
+	if (!reader.read32(uint64_t{hash_offset} + 4 + bucket * uint64_t{4}, icon_offset)) [[unlikely]]
+		return;
+
+	// bounds the walk in case a corrupt chain loops
+	for (size_t steps = 0; icon_offset != no_offset && steps < mapping_size / 12; steps++) {
+		uint32_t chain_offset, name_offset, list_offset;
+		if (!reader.read32(icon_offset, chain_offset)
+		    || !reader.read32(uint64_t{icon_offset} + 4, name_offset)
+		    || !reader.read32(uint64_t{icon_offset} + 8, list_offset)) [[unlikely]] {
+			return;
+		}
+
+		if (reader.string(name_offset) != name) {
+			icon_offset = chain_offset;
+			continue;
+		}
+
+		uint32_t num_images;
+		if (!reader.read32(list_offset, num_images)) [[unlikely]]
+			return;
+		for (uint32_t i = 0; i < num_images; i++) {
+			uint64_t  image_offset = uint64_t{list_offset} + 4 + i * uint64_t{8};
+			IconImage image;
+			if (!reader.read16(image_offset, image.dir)
+			    || !reader.read16(image_offset + 2, image.flags)) [[unlikely]] {
+				return;
+			}
+			images.push_back(image);
+		}
+		return;
+	}
+}
+
+namespace {
+
+using IniGroups = absl::flat_hash_map<std::string, absl::flat_hash_map<std::string, std::string>>;
+
+std::string_view trim(std::string_view s)
+{
+	auto is_space = [](unsigned char c) { return std::isspace(c); };
+	while (!s.empty() && is_space(s.front()))
+		s.remove_prefix(1);
+	while (!s.empty() && is_space(s.back()))
+		s.remove_suffix(1);
+	return s;
+}
+
+/// Parses the groups of an index.theme or settings.ini. Localized keys are
+/// kept as is; nothing here looks them up.
+IniGroups read_ini(const std::string &path)
+{
+	IniGroups groups;
+	std::ifstream file(path);
+	if (!file)
+		return groups;
+
+	// by name; the map gives no pointer stability
+	std::optional<std::string> group;
+	for (std::string line; std::getline(file, line);) {
+		auto s = trim(line);
+		if (s.empty() || s.front() == '#')
+			continue;
+		if (s.front() == '[') {
+			if (auto end = s.find(']'); end != s.npos)
+				group.emplace(s.substr(1, end - 1));
+			else
+				group.reset();
+			continue;
+		}
+		auto eq = s.find('=');
+		if (!group || eq == s.npos)
+			continue;
+		groups[*group].try_emplace(trim(s.substr(0, eq)), trim(s.substr(eq + 1)));
+	}
+	return groups;
+}
+
+std::optional<int> parse_int(const IniGroups::mapped_type &group, std::string_view key)
+{
+	auto it = group.find(key);
+	if (it == group.end())
+		return std::nullopt;
+	const auto &s   = it->second;
+	int         value;
+	auto [ptr, ec]  = std::from_chars(s.data(), s.data() + s.size(), value);
+	if (ec != std::errc{} || ptr != s.data() + s.size())
+		return std::nullopt;
+	return value;
+}
+
+auto split_list(std::string_view list)
+{
+	return list
+	       | std::views::split(std::string_view{","})
+	       | std::views::transform([](auto s) { return trim(std::string_view{s}); })
+	       | std::views::filter([](auto s) { return !s.empty(); });
+}
+
+/// Icon base dirs in GTK's order, each with trailing '/'.
+std::vector<std::string> get_icon_base_dirs(std::vector<std::string> &pixmap_dirs)
+{
+	std::vector<std::string> base_dirs;
+
+	auto home = std::getenv("HOME");
+	if (auto xdg = std::getenv("XDG_DATA_HOME"); xdg && xdg[0])
+		base_dirs.push_back(std::format("{}/icons/", xdg));
+	else if (home && home[0])
+		base_dirs.push_back(std::format("{}/.local/share/icons/", home));
+	if (home && home[0])
+		base_dirs.push_back(std::format("{}/.icons/", home));
+
+	std::string_view data_dirs = "/usr/local/share:/usr/share";
+	if (auto xdg = std::getenv("XDG_DATA_DIRS"); xdg && xdg[0])
+		data_dirs = xdg;
+	for (auto dir : data_dirs | std::views::split(std::string_view{":"})) {
+		std::string_view d{dir};
+		if (d.empty())
+			continue;
+		base_dirs.push_back(std::format("{}/icons/", d));
+		pixmap_dirs.push_back(std::format("{}/pixmaps/", d));
+	}
+
+	return base_dirs;
+}
+
+bool is_dir(const std::string &path)
+{
+	struct stat st;
+	return !stat(path.c_str(), &st) && S_ISDIR(st.st_mode);
+}
+
+uint16_t suffix_flag(std::string_view filename)
+{
+	if (filename.ends_with(".png"))
+		return has_suffix_png;
+	if (filename.ends_with(".svg"))
+		return has_suffix_svg;
+	if (filename.ends_with(".xpm"))
+		return has_suffix_xpm;
+	return 0;
+}
+
+/// The index GTK would use for a theme dir that has no cache.
+void index_dir(ThemeRoot &root, const IconDir &dir, uint16_t dir_idx)
+{
+	auto path = root.path + dir.name;
+	DIR *d    = opendir(path.c_str());
+	if (!d)
+		return;
+
+	while (auto *entry = readdir(d)) {
+		std::string_view filename = entry->d_name;
+		auto             flag     = suffix_flag(filename);
+		if (!flag)
+			continue;
+		filename.remove_suffix(4);
+
+		auto &images = root.index[filename];
+		if (!images.empty() && images.back().dir == dir_idx)
+			images.back().flags |= flag;
+		else
+			images.push_back({.dir = dir_idx, .flags = flag});
+	}
+	closedir(d);
+}
+
+/// Appends the theme's `Inherits=` to `parents`.
+std::optional<IconTheme> load_theme(
+    std::string_view             name,
+    std::span<const std::string> base_dirs,
+    std::vector<std::string>    &parents
+)
+{
+	IconTheme theme;
+	IniGroups index;
+
+	for (const auto &base : base_dirs) {
+		auto path = std::format("{}{}/", base, name);
+		if (!is_dir(path))
+			continue;
+		if (index.empty())
+			index = read_ini(path + "index.theme");
+		theme.roots.push_back({
+		    .path       = std::move(path),
+		    .cache      = {},
+		    .cache_dirs = {},
+		    .index      = {},
+		});
+	}
+
+	auto header = index.find("Icon Theme");
+	if (header == index.end())
+		return std::nullopt;
+
+	if (auto it = header->second.find("Inherits"); it != header->second.end()) {
+		for (auto parent : split_list(it->second))
+			parents.emplace_back(parent);
+	}
+
+	absl::flat_hash_map<std::string_view, int> dir_indices;
+	for (auto key : {"Directories", "ScaledDirectories"}) {
+		auto it = header->second.find(key);
+		if (it == header->second.end())
+			continue;
+		for (auto dir_name : split_list(it->second)) {
+			auto group = index.find(dir_name);
+			if (group == index.end() || dir_indices.contains(dir_name))
+				continue;
+			auto size = parse_int(group->second, "Size");
+			if (!size || theme.dirs.size() >= std::numeric_limits<uint16_t>::max()) [[unlikely]]
+				continue;
+
+			auto type    = IconDirType::Threshold;
+			auto context = std::string_view{};
+			if (auto t = group->second.find("Type"); t != group->second.end()) {
+				if (t->second == "Fixed")
+					type = IconDirType::Fixed;
+				else if (t->second == "Scalable")
+					type = IconDirType::Scalable;
+			}
+			if (auto c = group->second.find("Context"); c != group->second.end())
+				context = c->second;
+
+			theme.dirs.push_back({
+			    .name           = std::string{dir_name},
+			    .type           = type,
+			    .size           = *size,
+			    .min_size       = parse_int(group->second, "MinSize").value_or(*size),
+			    .max_size       = parse_int(group->second, "MaxSize").value_or(*size),
+			    .threshold      = parse_int(group->second, "Threshold").value_or(2),
+			    .scale          = parse_int(group->second, "Scale").value_or(1),
+			    .is_app_context = context == "Applications" || context == "apps",
+			});
+			dir_indices.emplace(group->first, static_cast<int>(theme.dirs.size() - 1));
+		}
+	}
+
+	for (auto &root : theme.roots) {
+		root.cache = IconCache::open(root.path);
+		if (root.cache) [[likely]] {
+			for (auto dir_name : root.cache.dirs()) {
+				auto it = dir_indices.find(dir_name);
+				root.cache_dirs.push_back(it == dir_indices.end() ? -1 : it->second);
+			}
+		} else {
+			for (size_t i = 0; i < theme.dirs.size(); i++)
+				index_dir(root, theme.dirs[i], static_cast<uint16_t>(i));
+		}
+	}
+
+	return theme;
+}
+
+/// GTK's `theme_dir_size_difference`, for an icon scale of 1.
+int size_distance(const IconDir &dir, int size)
+{
+	int min, max;
+	switch (dir.type) {
+	case IconDirType::Fixed:
+		return std::abs(dir.size * dir.scale - size);
+	case IconDirType::Scalable:
+		min = dir.min_size * dir.scale;
+		max = dir.max_size * dir.scale;
+		break;
+	case IconDirType::Threshold:
+	default:
+		min = (dir.size - dir.threshold) * dir.scale;
+		max = (dir.size + dir.threshold) * dir.scale;
+		break;
+	}
+	if (size < min)
+		return min - size;
+	if (size > max)
+		return size - max;
+	return 0;
+}
+
+/// Preferred suffix among `flags`. XPM is not decoded by `read_image`.
+std::string_view pick_suffix(uint16_t flags)
+{
+	if (flags & has_suffix_png)
+		return ".png";
+	if (flags & has_suffix_svg)
+		return ".svg";
+	return {};
+}
+
+} // namespace
+
+namespace wm {
+
+IconThemes::IconThemes(std::span<const std::string_view> names, int size) : size(size)
+{
+	if (names.empty())
+		return;
+
+	auto base_dirs = get_icon_base_dirs(pixmap_dirs);
+
+	absl::flat_hash_set<std::string> visited;
+	// depth-first, like the spec's FindIconHelper; hicolor always comes last
+	auto add = [&](this auto &self, std::string_view name) -> void {
+		if (name == "hicolor" || !visited.emplace(name).second)
+			return;
+		std::vector<std::string> parents;
+		if (auto theme = load_theme(name, base_dirs, parents))
+			themes.push_back(std::move(*theme));
+		for (const auto &parent : parents)
+			self(parent);
+	};
+	for (auto name : names)
+		add(name);
+
+	std::vector<std::string> ignored;
+	if (auto hicolor = load_theme("hicolor", base_dirs, ignored))
+		themes.push_back(std::move(*hicolor));
+}
+
+std::string IconThemes::find_icon(std::string_view name) const
+{
+	// not allowed by the spec, but found in the wild
+	if (suffix_flag(name))
+		name.remove_suffix(4);
+	if (name.empty() || name.find('/') != name.npos) [[unlikely]]
+		return {};
+
+	std::vector<IconImage> images;
+	for (const auto &theme : themes) {
+		// (distance * 2 + not Applications, dir): earlier dirs and roots win ties
+		std::pair<int, int> best_key{std::numeric_limits<int>::max(), 0};
+		const ThemeRoot    *best_root = nullptr;
+		const IconDir      *best_dir  = nullptr;
+		std::string_view    best_suffix;
+
+		for (const auto &root : theme.roots) {
+			images.clear();
+			if (root.cache) [[likely]] {
+				root.cache.find(name, images);
+			} else if (auto it = root.index.find(name); it != root.index.end()) {
+				images = it->second;
+			}
+
+			for (auto image : images) {
+				int dir_idx = image.dir;
+				if (root.cache) [[likely]] {
+					if (dir_idx >= static_cast<int>(root.cache_dirs.size())) [[unlikely]]
+						continue;
+					dir_idx = root.cache_dirs[dir_idx];
+					if (dir_idx < 0)
+						continue;
+				}
+				auto suffix = pick_suffix(image.flags);
+				if (suffix.empty())
+					continue;
+
+				const auto &dir = theme.dirs[dir_idx];
+				std::pair   key{size_distance(dir, size) * 2 + !dir.is_app_context, dir_idx};
+				if (key < best_key) {
+					best_key    = key;
+					best_root   = &root;
+					best_dir    = &dir;
+					best_suffix = suffix;
+				}
+			}
+		}
+
+		if (best_root)
+			return std::format("{}{}/{}{}", best_root->path, best_dir->name, name, best_suffix);
+	}
+
+	for (const auto &dir : pixmap_dirs) {
+		for (std::string_view suffix : {".png", ".svg"}) {
+			auto path = std::format("{}{}{}", dir, name, suffix);
+			if (!access(path.c_str(), R_OK))
+				return path;
+		}
+	}
+
+	return {};
+}
+
+std::string get_gtk_icon_theme_name()
+{
+	std::vector<std::string> config_dirs;
+	if (auto xdg = std::getenv("XDG_CONFIG_HOME"); xdg && xdg[0])
+		config_dirs.emplace_back(xdg);
+	else if (auto home = std::getenv("HOME"); home && home[0])
+		config_dirs.push_back(std::format("{}/.config", home));
+
+	std::string_view sys_dirs = "/etc/xdg";
+	if (auto xdg = std::getenv("XDG_CONFIG_DIRS"); xdg && xdg[0])
+		sys_dirs = xdg;
+	for (auto dir : sys_dirs | std::views::split(std::string_view{":"})) {
+		if (!std::string_view{dir}.empty())
+			config_dirs.emplace_back(std::string_view{dir});
+	}
+
+	for (const auto &dir : config_dirs) {
+		auto groups   = read_ini(dir + "/gtk-3.0/settings.ini");
+		auto settings = groups.find("Settings");
+		if (settings == groups.end())
+			continue;
+		if (auto it = settings->second.find("gtk-icon-theme-name"); it != settings->second.end())
+			return it->second;
+	}
+	return {};
+}
+
+} // namespace wm
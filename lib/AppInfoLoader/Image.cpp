@@ -1,32 +1,527 @@
 module;
 
+#include <fcntl.h>
+#include <immintrin.h>
 #include <librsvg/rsvg.h>
 #include <spng.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <turbojpeg.h>
+#include <unistd.h>
 
 module wm.AppInfoLoader.Image;
 
 import std;
 
+import wm.AppInfoLoader.Xdg;
+
+using std::uint16_t, std::uint64_t;
+
 using namespace wm;
 
-static std::vector<uint8_t> read_file(std::string_view path)
+/// Larger PNGs and JPEGs are rejected, which also keeps the downscaler's
+/// column sums within 32 bits.
+static constexpr uint32_t max_image_dimension = 16384;
+
+/// Uninitialized.
+static ImageBuffer make_image_buffer(size_t size) { return ImageBuffer(new uint8_t[size]); }
+
+static uint32_t load_u32(const uint8_t *p)
+{
+	uint32_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+// One set of kernels per instruction set:
+//
+// - `add` widens `width` 16-bit values of a row and adds them to the 32-bit
+//   column sums of the box filter.
+// - `expand_rgb`, `swizzle_bgra` and `premultiply` convert `lanes` pixels to
+//   premultiplied RGBA. `expand_rgb` reads up to 4 bytes past its pixels.
+
+struct Sse2 {
+	static constexpr size_t width = 8;
+	static constexpr size_t lanes = 4;
+
+	static void add(uint32_t *sums, const uint16_t *row)
+	{
+		auto  v    = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row));
+		auto  zero = _mm_setzero_si128();
+		auto *s    = reinterpret_cast<__m128i *>(sums);
+		_mm_storeu_si128(s, _mm_add_epi32(_mm_loadu_si128(s), _mm_unpacklo_epi16(v, zero)));
+		_mm_storeu_si128(
+		    s + 1, _mm_add_epi32(_mm_loadu_si128(s + 1), _mm_unpackhi_epi16(v, zero))
+		);
+	}
+
+	static void expand_rgb(uint8_t *dst, const uint8_t *src)
+	{
+		auto v = _mm_setr_epi32(
+		    static_cast<int>(load_u32(src)),
+		    static_cast<int>(load_u32(src + 3)),
+		    static_cast<int>(load_u32(src + 6)),
+		    static_cast<int>(load_u32(src + 9))
+		);
+		auto alpha = _mm_set1_epi32(static_cast<int>(0xff00'0000));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_or_si128(v, alpha));
+	}
+
+	static void swizzle_bgra(uint8_t *pixels)
+	{
+		auto *p  = reinterpret_cast<__m128i *>(pixels);
+		auto  v  = _mm_loadu_si128(p);
+		auto  ga = _mm_and_si128(v, _mm_set1_epi32(static_cast<int>(0xff00'ff00)));
+		auto  rb = _mm_and_si128(v, _mm_set1_epi32(0x00ff'00ff));
+		rb       = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+		_mm_storeu_si128(p, _mm_or_si128(ga, rb));
+	}
+
+	/// x * a / 255, rounded, for 16-bit words. The alpha words are
+	/// multiplied by 255 so that they come out unchanged.
+	static __m128i premultiply_words(__m128i v)
+	{
+		auto mask  = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+		auto alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xff), 0xff);
+		auto max   = _mm_and_si128(mask, _mm_set1_epi16(255));
+		alpha      = _mm_or_si128(_mm_andnot_si128(mask, alpha), max);
+		auto t     = _mm_add_epi16(_mm_mullo_epi16(v, alpha), _mm_set1_epi16(128));
+		return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+	}
+
+	static void premultiply(uint8_t *pixels)
+	{
+		auto *p    = reinterpret_cast<__m128i *>(pixels);
+		auto  v    = _mm_loadu_si128(p);
+		auto  zero = _mm_setzero_si128();
+		_mm_storeu_si128(
+		    p,
+		    _mm_packus_epi16(
+		        premultiply_words(_mm_unpacklo_epi8(v, zero)),
+		        premultiply_words(_mm_unpackhi_epi8(v, zero))
+		    )
+		);
+	}
+};
+
+struct Avx2 {
+	static constexpr size_t width = 8;
+	static constexpr size_t lanes = 8;
+
+	[[gnu::target("avx2")]]
+	static void add(uint32_t *sums, const uint16_t *row)
+	{
+		auto  v = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row)));
+		auto *s = reinterpret_cast<__m256i *>(sums);
+		_mm256_storeu_si256(s, _mm256_add_epi32(_mm256_loadu_si256(s), v));
+	}
+
+	[[gnu::target("avx2")]]
+	static void expand_rgb(uint8_t *dst, const uint8_t *src)
+	{
+		auto lo      = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+		auto hi      = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 12));
+		auto v       = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+		auto shuffle = _mm256_setr_epi8(
+		    0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+		    0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1
+		);
+		auto alpha   = _mm256_set1_epi32(static_cast<int>(0xff00'0000));
+		auto rgba    = _mm256_or_si256(_mm256_shuffle_epi8(v, shuffle), alpha);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), rgba);
+	}
+
+	[[gnu::target("avx2")]]
+	static void swizzle_bgra(uint8_t *pixels)
+	{
+		auto *p       = reinterpret_cast<__m256i *>(pixels);
+		auto  shuffle = _mm256_setr_epi8(
+		    2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+		    2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15
+		);
+		_mm256_storeu_si256(p, _mm256_shuffle_epi8(_mm256_loadu_si256(p), shuffle));
+	}
+
+	[[gnu::target("avx2")]]
+	static __m256i premultiply_words(__m256i v)
+	{
+		auto mask  = _mm256_set1_epi64x(static_cast<long long>(0xffff'0000'0000'0000));
+		auto alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, 0xff), 0xff);
+		alpha      = _mm256_blendv_epi8(alpha, _mm256_set1_epi16(255), mask);
+		auto t     = _mm256_add_epi16(_mm256_mullo_epi16(v, alpha), _mm256_set1_epi16(128));
+		return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+	}
+
+	[[gnu::target("avx2")]]
+	static void premultiply(uint8_t *pixels)
+	{
+		auto *p    = reinterpret_cast<__m256i *>(pixels);
+		auto  v    = _mm256_loadu_si256(p);
+		auto  zero = _mm256_setzero_si256();
+		// unpacking and packing within 128-bit lanes keeps the pixel order
+		_mm256_storeu_si256(
+		    p,
+		    _mm256_packus_epi16(
+		        premultiply_words(_mm256_unpacklo_epi8(v, zero)),
+		        premultiply_words(_mm256_unpackhi_epi8(v, zero))
+		    )
+		);
+	}
+};
+
+struct Avx512 {
+	static constexpr size_t width = 16;
+	static constexpr size_t lanes = 16;
+
+	[[gnu::target("avx512bw")]]
+	static void add(uint32_t *sums, const uint16_t *row)
+	{
+		auto v =
+		    _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(row)));
+		_mm512_storeu_si512(sums, _mm512_add_epi32(_mm512_loadu_si512(sums), v));
+	}
+
+	[[gnu::target("avx512bw")]]
+	static __m512i broadcast_lanes(__m128i v)
+	{ return _mm512_broadcast_i32x4(v); }
+
+	[[gnu::target("avx512bw")]]
+	static void expand_rgb(uint8_t *dst, const uint8_t *src)
+	{
+		auto load = [src](size_t offset) {
+			return _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + offset));
+		};
+		auto v = _mm512_castsi128_si512(load(0));
+		v      = _mm512_inserti32x4(v, load(12), 1);
+		v      = _mm512_inserti32x4(v, load(24), 2);
+		v      = _mm512_inserti32x4(v, load(36), 3);
+		auto shuffle =
+		    broadcast_lanes(_mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1));
+		auto alpha = _mm512_set1_epi32(static_cast<int>(0xff00'0000));
+		_mm512_storeu_si512(dst, _mm512_or_si512(_mm512_shuffle_epi8(v, shuffle), alpha));
+	}
+
+	[[gnu::target("avx512bw")]]
+	static void swizzle_bgra(uint8_t *pixels)
+	{
+		auto shuffle =
+		    broadcast_lanes(_mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15));
+		_mm512_storeu_si512(pixels, _mm512_shuffle_epi8(_mm512_loadu_si512(pixels), shuffle));
+	}
+
+	[[gnu::target("avx512bw")]]
+	static __m512i premultiply_words(__m512i v)
+	{
+		auto alpha = _mm512_shufflehi_epi16(_mm512_shufflelo_epi16(v, 0xff), 0xff);
+		// every 4th word is alpha
+		alpha      = _mm512_mask_mov_epi16(alpha, 0x8888'8888, _mm512_set1_epi16(255));
+		auto t     = _mm512_add_epi16(_mm512_mullo_epi16(v, alpha), _mm512_set1_epi16(128));
+		return _mm512_srli_epi16(_mm512_add_epi16(t, _mm512_srli_epi16(t, 8)), 8);
+	}
+
+	[[gnu::target("avx512bw")]]
+	static void premultiply(uint8_t *pixels)
+	{
+		auto v    = _mm512_loadu_si512(pixels);
+		auto zero = _mm512_setzero_si512();
+		_mm512_storeu_si512(
+		    pixels,
+		    _mm512_packus_epi16(
+		        premultiply_words(_mm512_unpacklo_epi8(v, zero)),
+		        premultiply_words(_mm512_unpackhi_epi8(v, zero))
+		    )
+		);
+	}
+};
+
+template <typename Isa>
+[[gnu::always_inline]]
+static inline void add_row(uint32_t *sums, const uint16_t *row, size_t n)
+{
+	size_t i = 0;
+	for (; i + Isa::width <= n; i += Isa::width)
+		Isa::add(sums + i, row + i);
+	for (; i < n; i++)
+		sums[i] += row[i];
+}
+
+static void add_row_sse2(uint32_t *sums, const uint16_t *row, size_t n)
+{ add_row<Sse2>(sums, row, n); }
+
+[[gnu::target("avx2")]]
+static void add_row_avx2(uint32_t *sums, const uint16_t *row, size_t n)
+{ add_row<Avx2>(sums, row, n); }
+
+[[gnu::target("avx512bw")]]
+static void add_row_avx512(uint32_t *sums, const uint16_t *row, size_t n)
+{ add_row<Avx512>(sums, row, n); }
+
+static auto select_add_row(SimdLevel level)
+{
+	switch (level) {
+	case SimdLevel::AVX512BW: return add_row_avx512;
+	case SimdLevel::AVX2:     return add_row_avx2;
+	case SimdLevel::SSE2:     return add_row_sse2;
+	}
+	std::unreachable();
+}
+
+template <typename Isa>
+[[gnu::always_inline]]
+static inline void expand_rgb(uint8_t *dst, const uint8_t *src, size_t n)
+{
+	size_t i = 0;
+	// two spare pixels cover the kernel's overread
+	for (; i + Isa::lanes + 2 <= n; i += Isa::lanes)
+		Isa::expand_rgb(dst + i * 4, src + i * 3);
+	for (; i < n; i++) {
+		dst[i * 4]     = src[i * 3];
+		dst[i * 4 + 1] = src[i * 3 + 1];
+		dst[i * 4 + 2] = src[i * 3 + 2];
+		dst[i * 4 + 3] = 255;
+	}
+}
+
+template <typename Isa>
+[[gnu::always_inline]]
+static inline void swizzle_bgra(uint8_t *pixels, size_t n)
 {
-	try {
-		std::ifstream file(std::string(path), std::ios::binary | std::ios::ate);
-		if (!file)
+	size_t i = 0;
+	for (; i + Isa::lanes <= n; i += Isa::lanes)
+		Isa::swizzle_bgra(pixels + i * 4);
+	for (; i < n; i++)
+		std::swap(pixels[i * 4], pixels[i * 4 + 2]);
+}
+
+template <typename Isa>
+[[gnu::always_inline]]
+static inline void premultiply(uint8_t *pixels, size_t n)
+{
+	size_t i = 0;
+	for (; i + Isa::lanes <= n; i += Isa::lanes)
+		Isa::premultiply(pixels + i * 4);
+	for (; i < n; i++) {
+		uint32_t alpha = pixels[i * 4 + 3];
+		for (size_t c = 0; c < 3; c++) {
+			uint32_t t        = pixels[i * 4 + c] * alpha + 128;
+			pixels[i * 4 + c] = static_cast<uint8_t>((t + (t >> 8)) >> 8);
+		}
+	}
+}
+
+struct PixelKernels {
+	void (*expand_rgb)(uint8_t *dst, const uint8_t *src, size_t n);
+	void (*swizzle_bgra)(uint8_t *pixels, size_t n);
+	void (*premultiply)(uint8_t *pixels, size_t n);
+};
+
+static void expand_rgb_sse2(uint8_t *dst, const uint8_t *src, size_t n)
+{ expand_rgb<Sse2>(dst, src, n); }
+
+static void swizzle_bgra_sse2(uint8_t *pixels, size_t n) { swizzle_bgra<Sse2>(pixels, n); }
+
+static void premultiply_sse2(uint8_t *pixels, size_t n) { premultiply<Sse2>(pixels, n); }
+
+[[gnu::target("avx2")]]
+static void expand_rgb_avx2(uint8_t *dst, const uint8_t *src, size_t n)
+{ expand_rgb<Avx2>(dst, src, n); }
+
+[[gnu::target("avx2")]]
+static void swizzle_bgra_avx2(uint8_t *pixels, size_t n) { swizzle_bgra<Avx2>(pixels, n); }
+
+[[gnu::target("avx2")]]
+static void premultiply_avx2(uint8_t *pixels, size_t n) { premultiply<Avx2>(pixels, n); }
+
+[[gnu::target("avx512bw")]]
+static void expand_rgb_avx512(uint8_t *dst, const uint8_t *src, size_t n)
+{ expand_rgb<Avx512>(dst, src, n); }
+
+[[gnu::target("avx512bw")]]
+static void swizzle_bgra_avx512(uint8_t *pixels, size_t n) { swizzle_bgra<Avx512>(pixels, n); }
+
+[[gnu::target("avx512bw")]]
+static void premultiply_avx512(uint8_t *pixels, size_t n) { premultiply<Avx512>(pixels, n); }
+
+static PixelKernels select_pixel_kernels(SimdLevel level)
+{
+	switch (level) {
+	case SimdLevel::AVX512BW:
+		return {expand_rgb_avx512, swizzle_bgra_avx512, premultiply_avx512};
+	case SimdLevel::AVX2:     return {expand_rgb_avx2, swizzle_bgra_avx2, premultiply_avx2};
+	case SimdLevel::SSE2:     return {expand_rgb_sse2, swizzle_bgra_sse2, premultiply_sse2};
+	}
+	std::unreachable();
+}
+
+/// First source pixel of box `i` when `src` pixels are averaged into `dst`.
+static uint32_t box_start(uint32_t i, uint32_t src, uint32_t dst)
+{ return static_cast<uint32_t>(uint64_t{i} * src / dst); }
+
+/// Area-averaging downscaler fed one source row at a time, so that large
+/// images never have to be held in full. Colors are weighted by alpha so
+/// that fully transparent pixels don't bleed into their neighbors.
+class BoxDownscaler {
+	uint32_t              src_width;
+	uint32_t              src_height;
+	uint32_t              dst_width;
+	uint32_t              dst_height;
+	uint32_t              channels;
+	/// The current source row, premultiplied if there is alpha.
+	std::vector<uint16_t> row;
+	/// Per source column, of the rows added to the current destination row.
+	std::vector<uint32_t> sums;
+	uint32_t              src_y;
+	uint32_t              dst_y;
+	ImageBuffer           buffer;
+
+public:
+	BoxDownscaler(
+	    uint32_t    src_width,
+	    uint32_t    src_height,
+	    uint32_t    dst_width,
+	    uint32_t    dst_height,
+	    ImageFormat format
+	) :
+	    src_width(src_width),
+	    src_height(src_height),
+	    dst_width(dst_width),
+	    dst_height(dst_height),
+	    channels(get_pixel_size(format)),
+	    row(size_t{src_width} * channels),
+	    sums(size_t{src_width} * channels),
+	    src_y(0),
+	    dst_y(0),
+	    buffer(make_image_buffer(size_t{dst_width} * dst_height * channels))
+	{}
+
+	void add_row(const uint8_t *pixels)
+	{
+		if (channels == 4) {
+			for (size_t i = 0; i < row.size(); i += 4) {
+				uint16_t alpha = pixels[i + 3];
+				row[i]         = pixels[i] * alpha;
+				row[i + 1]     = pixels[i + 1] * alpha;
+				row[i + 2]     = pixels[i + 2] * alpha;
+				row[i + 3]     = alpha;
+			}
+		} else {
+			std::copy_n(pixels, row.size(), row.begin());
+		}
+
+		static const auto add = select_add_row(get_simd_level());
+		add(sums.data(), row.data(), row.size());
+
+		if (++src_y == box_start(dst_y + 1, src_height, dst_height))
+			finish_row();
+	}
+
+	/// The downscaled pixels, null unless all source rows were added.
+	ImageBuffer finish()
+	{
+		if (dst_y != dst_height) [[unlikely]]
 			return {};
-		auto size = file.tellg();
-		file.seekg(0);
-		std::vector<uint8_t> buffer(size);
-		file.read(reinterpret_cast<char *>(buffer.data()), size);
-		return buffer;
-	} catch (...) {
-		return {};
+		return std::move(buffer);
+	}
+
+private:
+	void finish_row()
+	{
+		auto  rows = src_y - box_start(dst_y, src_height, dst_height);
+		auto *out  = buffer.get() + size_t{dst_y} * dst_width * channels;
+		for (uint32_t x = 0; x < dst_width; x++) {
+			auto first = box_start(x, src_width, dst_width);
+			auto last  = box_start(x + 1, src_width, dst_width);
+
+			uint64_t totals[4] = {};
+			for (auto sx = first; sx < last; sx++) {
+				for (uint32_t c = 0; c < channels; c++)
+					totals[c] += sums[size_t{sx} * channels + c];
+			}
+
+			uint64_t count = uint64_t{rows} * (last - first);
+			if (channels == 4) {
+				uint64_t alpha = totals[3];
+				for (uint32_t c = 0; c < 3; c++)
+					out[c] = alpha ? static_cast<uint8_t>((totals[c] + alpha / 2) / alpha) : 0;
+				out[3] = static_cast<uint8_t>((alpha + count / 2) / count);
+			} else {
+				for (uint32_t c = 0; c < channels; c++)
+					out[c] = static_cast<uint8_t>((totals[c] + count / 2) / count);
+			}
+			out += channels;
+		}
+		std::ranges::fill(sums, 0);
+		dst_y++;
 	}
+};
+
+static bool needs_downscale(uint32_t width, uint32_t height, int size)
+{ return size > 0 && std::max(width, height) > static_cast<uint32_t>(size); }
+
+/// `width`×`height` scaled so that the longer side is `size`.
+static std::pair<uint32_t, uint32_t> fit_size(uint32_t width, uint32_t height, int size)
+{
+	auto longer = std::max(width, height);
+	auto scale  = [&](uint32_t d) {
+		return std::max<uint32_t>(1, (uint64_t{d} * size + longer / 2) / longer);
+	};
+	return {scale(width), scale(height)};
 }
 
-static Image load_png(std::span<uint8_t> data)
+/// `image`, downscaled if it is larger than `size`.
+static Image fit_image(Image image, int size)
+{
+	if (!image.buffer || !needs_downscale(image.width, image.height, size))
+		return image;
+
+	auto [width, height] = fit_size(image.width, image.height, size);
+	BoxDownscaler scaler(image.width, image.height, width, height, image.format);
+	auto          stride = size_t{image.width} * get_pixel_size(image.format);
+	for (uint32_t y = 0; y < image.height; y++)
+		scaler.add_row(image.buffer.get() + y * stride);
+	return {scaler.finish(), width, height, image.format};
+}
+
+/// A read-only mapping of a whole file, empty if the file can't be mapped.
+class MappedFile {
+	void  *ptr;
+	size_t size;
+
+public:
+	explicit MappedFile(const char *path) : ptr(nullptr), size(0)
+	{
+		int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+		if (fd == -1)
+			return;
+
+		struct stat st;
+		if (!fstat(fd, &st) && st.st_size > 0) [[likely]] {
+			ptr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			if (ptr != MAP_FAILED) [[likely]] {
+				size = static_cast<size_t>(st.st_size);
+				// the decoders read front to back, once
+				madvise(ptr, size, MADV_SEQUENTIAL);
+			} else {
+				ptr = nullptr;
+			}
+		}
+		close(fd);
+	}
+
+	MappedFile(const MappedFile &)            = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	~MappedFile()
+	{
+		if (ptr)
+			munmap(ptr, size);
+	}
+
+	[[nodiscard]] std::span<const uint8_t> data() const
+	{ return {static_cast<const uint8_t *>(ptr), size}; }
+};
+
+static Image load_png(std::span<const uint8_t> data, int size)
 {
 	if (data.empty())
 		return {};
@@ -38,7 +533,8 @@ static Image load_png(std::span<uint8_t> data)
 	spng_set_png_buffer(ctx, data.data(), data.size());
 
 	spng_ihdr ihdr{};
-	if (spng_get_ihdr(ctx, &ihdr)) {
+	if (spng_get_ihdr(ctx, &ihdr) || ihdr.width > max_image_dimension
+	    || ihdr.height > max_image_dimension) {
 		spng_ctx_free(ctx);
 		return {};
 	}
@@ -54,23 +550,43 @@ static Image load_png(std::span<uint8_t> data)
 		return {};
 	}
 
-	auto buffer = std::make_unique<uint8_t[]>(out_size);
-	if (spng_decode_image(ctx, buffer.get(), out_size, fmt, 0)) {
+	auto format = fmt == SPNG_FMT_RGBA8 ? ImageFormat::RGBA : ImageFormat::RGB;
+
+	// Interlaced rows arrive out of order, so those images are decoded in
+	// full before downscaling.
+	if (!needs_downscale(ihdr.width, ihdr.height, size)
+	    || ihdr.interlace_method != SPNG_INTERLACE_NONE) {
+		auto buffer = make_image_buffer(out_size);
+		if (spng_decode_image(ctx, buffer.get(), out_size, fmt, 0)) {
+			spng_ctx_free(ctx);
+			return {};
+		}
+
 		spng_ctx_free(ctx);
-		return {};
+
+		return fit_image({std::move(buffer), ihdr.width, ihdr.height, format}, size);
+	}
+
+	auto [width, height] = fit_size(ihdr.width, ihdr.height, size);
+	BoxDownscaler        scaler(ihdr.width, ihdr.height, width, height, format);
+	std::vector<uint8_t> row(out_size / ihdr.height);
+
+	int ret = spng_decode_image(ctx, nullptr, 0, fmt, SPNG_DECODE_PROGRESSIVE);
+	while (!ret) {
+		// SPNG_EOI comes with the last row
+		ret = spng_decode_row(ctx, row.data(), row.size());
+		if (!ret || ret == SPNG_EOI)
+			scaler.add_row(row.data());
 	}
 
 	spng_ctx_free(ctx);
+	if (ret != SPNG_EOI)
+		return {};
 
-	return {
-	    std::move(buffer),
-	    ihdr.width,
-	    ihdr.height,
-	    fmt == SPNG_FMT_RGBA8 ? ImageFormat::RGBA : ImageFormat::RGB
-	};
+	return {scaler.finish(), width, height, format};
 }
 
-static Image load_jpg(std::span<uint8_t> data)
+static Image load_jpg(std::span<const uint8_t> data, int size)
 {
 	if (data.empty())
 		return {};
@@ -82,12 +598,35 @@ static Image load_jpg(std::span<uint8_t> data)
 	int width, height, subsamp, colorspace;
 	if (tjDecompressHeader3(
 	        handle, data.data(), data.size(), &width, &height, &subsamp, &colorspace
-	    )) {
+	    )
+	    || static_cast<uint32_t>(width) > max_image_dimension
+	    || static_cast<uint32_t>(height) > max_image_dimension) {
 		tjDestroy(handle);
 		return {};
 	}
 
-	auto buffer = std::make_unique<uint8_t[]>(width * height * 3);
+	// The decoder scales by multiples of 1/8 almost for free. Pick the
+	// smallest scale that still covers `size` and leave the rest to the box
+	// filter.
+	if (needs_downscale(width, height, size)) {
+		int             num_factors;
+		auto            factors = tjGetScalingFactors(&num_factors);
+		int             longer  = std::max(width, height);
+		int             best    = longer;
+		tjscalingfactor best_factor{1, 1};
+		for (auto factor : std::span{factors, static_cast<size_t>(num_factors)}) {
+			int scaled = TJSCALED(longer, factor);
+			if (scaled >= size && scaled < best) {
+				best        = scaled;
+				best_factor = factor;
+			}
+		}
+		// the size the decoder writes, see tjDecompress2
+		width  = TJSCALED(width, best_factor);
+		height = TJSCALED(height, best_factor);
+	}
+
+	auto buffer = make_image_buffer(width * height * 3);
 	if (tjDecompress2(
 	        handle, data.data(), data.size(), buffer.get(), width, 0, height, TJPF_RGB, 0
 	    )) {
@@ -97,12 +636,15 @@ static Image load_jpg(std::span<uint8_t> data)
 
 	tjDestroy(handle);
 
-	return {
-	    std::move(buffer),
-	    static_cast<uint32_t>(width),
-	    static_cast<uint32_t>(height),
-	    ImageFormat::RGB
-	};
+	return fit_image(
+	    {
+	        std::move(buffer),
+	        static_cast<uint32_t>(width),
+	        static_cast<uint32_t>(height),
+	        ImageFormat::RGB,
+	    },
+	    size
+	);
 }
 
 static Image load_svg(const char *path, int target_size)
@@ -131,7 +673,9 @@ static Image load_svg(const char *path, int target_size)
 		width = height = target_size;
 	}
 
-	auto             buffer  = std::make_unique<uint8_t[]>(width * height * 4);
+	auto buffer = make_image_buffer(width * height * 4);
+	// cairo composites onto the buffer's contents
+	std::memset(buffer.get(), 0, width * height * 4);
 	cairo_surface_t *surface = cairo_image_surface_create_for_data(
 	    buffer.get(), CAIRO_FORMAT_ARGB32, width, height, width * 4
 	);
@@ -160,16 +704,48 @@ static Image load_svg(const char *path, int target_size)
 }
 
 namespace wm {
+void ImageDeleter::operator()(uint8_t *pixels) const
+{
+	if (mapping)
+		munmap(mapping, mapping_size);
+	else
+		delete[] pixels;
+}
+
+uint32_t get_pixel_size(ImageFormat format) { return format == ImageFormat::RGB ? 3 : 4; }
+
+Image normalize_image(Image image)
+{
+	if (!image.buffer)
+		return image;
+
+	static const auto kernels = select_pixel_kernels(get_simd_level());
+	auto              n       = size_t{image.width} * image.height;
+	switch (image.format) {
+	case ImageFormat::RGB: {
+		auto buffer = make_image_buffer(n * 4);
+		kernels.expand_rgb(buffer.get(), image.buffer.get(), n);
+		image.buffer = std::move(buffer);
+		break;
+	}
+	case ImageFormat::RGBA:              kernels.premultiply(image.buffer.get(), n); break;
+	// cairo's ARGB32 is already premultiplied
+	case ImageFormat::BGRA:              kernels.swizzle_bgra(image.buffer.get(), n); break;
+	case ImageFormat::PremultipliedRGBA: break;
+	}
+	image.format = ImageFormat::PremultipliedRGBA;
+	return image;
+}
+
 Image read_image(const char *path, int size)
 {
 	auto p = std::string_view{path};
 	if (p.ends_with(".svg"))
 		return load_svg(path, size);
-	auto data = read_file(p);
 	if (p.ends_with(".png"))
-		return load_png(data);
+		return load_png(MappedFile(path).data(), size);
 	if (p.ends_with(".jpg") || p.ends_with(".jpeg"))
-		return load_jpg(data);
+		return load_jpg(MappedFile(path).data(), size);
 	return {};
 }
 } // namespace wm
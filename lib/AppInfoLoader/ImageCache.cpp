@@ -0,0 +1,266 @@
+module;
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+module wm.AppInfoLoader.ImageCache;
+
+import std;
+import llvm.Support;
+
+using namespace wm;
+
+// Layout: Header | path | padding | pixels
+//
+// Native endianness like the app index. Pixels are premultiplied RGBA and
+// start on a 64-byte boundary so that they can be uploaded straight from the
+// mapping.
+
+static constexpr char     magic[8]     = {'W', 'M', 'I', 'C', 'O', 'N', 'P', 'X'};
+static constexpr uint32_t version      = 2;
+static constexpr size_t   pixels_align = 64;
+
+struct Header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t path_length;
+	int64_t  source_mtime_ns;
+	int64_t  source_size;
+	uint32_t size;
+	uint32_t width;
+	uint32_t height;
+	uint8_t  format;
+	uint8_t  reserved[3];
+};
+
+static std::string get_cache_dir()
+{
+	if (auto xdg = std::getenv("XDG_CACHE_HOME"); xdg && xdg[0])
+		return std::format("{}/wm/icons/", xdg);
+	if (auto home = std::getenv("HOME"); home && home[0])
+		return std::format("{}/.cache/wm/icons/", home);
+	return {};
+}
+
+static size_t get_pixels_offset(size_t path_length)
+{ return (sizeof(Header) + path_length + pixels_align - 1) & ~(pixels_align - 1); }
+
+static uint64_t fnv1a(uint64_t h, std::span<const char> bytes)
+{
+	for (unsigned char c : bytes) {
+		h ^= c;
+		h *= 0x100000001b3;
+	}
+	return h;
+}
+
+static uint64_t hash_entry(std::string_view path, const ImageKey &key)
+{
+	auto h = fnv1a(0xcbf29ce484222325, path);
+	h      = fnv1a(h, std::span{reinterpret_cast<const char *>(&key.mtime_ns), 8});
+	h      = fnv1a(h, std::span{reinterpret_cast<const char *>(&key.file_size), 8});
+	return fnv1a(h, std::span{reinterpret_cast<const char *>(&key.size), 4});
+}
+
+namespace wm {
+
+ImageCache::ImageCache(uint64_t max_bytes) :
+    dir(get_cache_dir()),
+    max_bytes(max_bytes),
+    total_bytes(-1)
+{}
+
+Image ImageCache::read(const char *path, int size)
+{
+	struct stat st;
+	if (dir.empty() || size <= 0 || stat(path, &st)) [[unlikely]]
+		return normalize_image(read_image(path, size));
+
+	ImageKey key{
+	    .mtime_ns  = int64_t{st.st_mtim.tv_sec} * 1'000'000'000 + st.st_mtim.tv_nsec,
+	    .file_size = st.st_size,
+	    .size      = static_cast<uint32_t>(size),
+	};
+	auto entry_path = std::format("{}{:016x}", dir, hash_entry(path, key));
+
+	if (auto image = find(entry_path, path, key); image.buffer)
+		return image;
+
+	// normalized before it is stored, so that hits need no conversion
+	auto image = normalize_image(read_image(path, size));
+	if (image.buffer)
+		store(entry_path, path, key, image);
+	return image;
+}
+
+Image ImageCache::find(const std::string &entry_path, std::string_view path, const ImageKey &key)
+{
+	int fd = ::open(entry_path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return {};
+
+	struct stat st;
+	if (fstat(fd, &st) || static_cast<size_t>(st.st_size) < sizeof(Header)) [[unlikely]] {
+		close(fd);
+		return {};
+	}
+
+	// stored pixels are final, so the mapping is shared with the page cache
+	auto  size = static_cast<size_t>(st.st_size);
+	void *ptr  = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	if (ptr == MAP_FAILED) [[unlikely]] {
+		close(fd);
+		return {};
+	}
+
+	const auto *h      = static_cast<const Header *>(ptr);
+	const auto *stored = static_cast<const char *>(ptr) + sizeof(Header);
+	auto        format = static_cast<ImageFormat>(h->format);
+	bool        is_hit = !std::memcmp(h->magic, magic, sizeof(magic))
+	              && h->version == version
+	              && h->path_length == path.length()
+	              && h->source_mtime_ns == key.mtime_ns
+	              && h->source_size == key.file_size
+	              && h->size == key.size
+	              && format == ImageFormat::PremultipliedRGBA
+	              && sizeof(Header) + path.length() <= size
+	              && !std::memcmp(stored, path.data(), path.length())
+	              && get_pixels_offset(path.length())
+	                         + uint64_t{h->width} * h->height * get_pixel_size(format)
+	                     == size;
+	if (!is_hit) {
+		munmap(ptr, size);
+		close(fd);
+		return {};
+	}
+
+	// eviction goes by mtime
+	struct timespec times[2] = {
+	    {.tv_sec = 0, .tv_nsec = UTIME_OMIT},
+	    {.tv_sec = 0, .tv_nsec = UTIME_NOW},
+	};
+	futimens(fd, times);
+	close(fd);
+
+	auto *pixels = static_cast<uint8_t *>(ptr) + get_pixels_offset(path.length());
+	return {
+	    .buffer = ImageBuffer(pixels, {.mapping = ptr, .mapping_size = size}),
+	    .width  = h->width,
+	    .height = h->height,
+	    .format = format,
+	};
+}
+
+void ImageCache::store(
+    const std::string &entry_path,
+    std::string_view   path,
+    const ImageKey    &key,
+    const Image       &image
+)
+{
+	if (path.length() > std::numeric_limits<uint32_t>::max()) [[unlikely]]
+		return;
+
+	Header h{};
+	std::memcpy(h.magic, magic, sizeof(magic));
+	h.version         = version;
+	h.path_length     = static_cast<uint32_t>(path.length());
+	h.source_mtime_ns = key.mtime_ns;
+	h.source_size     = key.file_size;
+	h.size            = key.size;
+	h.width           = image.width;
+	h.height          = image.height;
+	h.format          = static_cast<uint8_t>(image.format);
+
+	if (llvm::sys::fs::create_directories(llvm::sys::path::parent_path(entry_path))) [[unlikely]]
+		return;
+
+	auto tmp_path = entry_path + ".XXXXXX";
+	int  fd       = mkstemp(tmp_path.data());
+	if (fd == -1) [[unlikely]]
+		return;
+
+	auto write_all = [fd](const void *data, size_t size) {
+		const char *ptr = static_cast<const char *>(data);
+		while (size > 0) {
+			auto written = ::write(fd, ptr, size);
+			if (written > 0) {
+				ptr  += written;
+				size -= written;
+			} else if (written == 0 || errno != EINTR) [[unlikely]] {
+				return false;
+			}
+		}
+		return true;
+	};
+
+	static constexpr char padding[pixels_align] = {};
+
+	auto pixels_offset = get_pixels_offset(path.length());
+	auto pixels_size   = size_t{image.width} * image.height * get_pixel_size(image.format);
+	bool ok            = write_all(&h, sizeof(h))
+	          && write_all(path.data(), path.length())
+	          && write_all(padding, pixels_offset - sizeof(h) - path.length())
+	          && write_all(image.buffer.get(), pixels_size);
+	close(fd);
+
+	if (!ok || std::rename(tmp_path.c_str(), entry_path.c_str())) [[unlikely]] {
+		unlink(tmp_path.c_str());
+		return;
+	}
+
+	std::lock_guard lock(mtx);
+	if (total_bytes >= 0)
+		total_bytes += static_cast<int64_t>(pixels_offset + pixels_size);
+	evict();
+}
+
+void ImageCache::evict()
+{
+	if (total_bytes >= 0 && static_cast<uint64_t>(total_bytes) <= max_bytes)
+		return;
+
+	DIR *d = opendir(dir.c_str());
+	if (!d) [[unlikely]]
+		return;
+
+	struct Entry {
+		int64_t     mtime_ns;
+		int64_t     size;
+		std::string name;
+	};
+	std::vector<Entry> entries;
+	total_bytes = 0;
+	while (auto *dp = readdir(d)) {
+		struct stat st;
+		if (dp->d_name[0] == '.' || fstatat(dirfd(d), dp->d_name, &st, AT_SYMLINK_NOFOLLOW)
+		    || !S_ISREG(st.st_mode)) {
+			continue;
+		}
+		total_bytes += st.st_size;
+		entries.push_back({
+		    .mtime_ns = int64_t{st.st_mtim.tv_sec} * 1'000'000'000 + st.st_mtim.tv_nsec,
+		    .size     = st.st_size,
+		    .name     = dp->d_name,
+		});
+	}
+
+	// leave some room so that the next few stores don't list the dir again
+	if (static_cast<uint64_t>(total_bytes) > max_bytes) {
+		std::ranges::sort(entries, {}, &Entry::mtime_ns);
+		for (const auto &entry : entries) {
+			if (static_cast<uint64_t>(total_bytes) <= max_bytes / 4 * 3)
+				break;
+			if (!unlinkat(dirfd(d), entry.name.c_str(), 0))
+				total_bytes -= entry.size;
+		}
+	}
+	closedir(d);
+}
+
+} // namespace wm
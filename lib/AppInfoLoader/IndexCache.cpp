@@ -0,0 +1,340 @@
+module;
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+module wm.AppInfoLoader.IndexCache;
+
+import std;
+import llvm.Support;
+
+using std::uint64_t;
+
+using namespace wm;
+
+// Layout: Header | DirRecord[num_dirs] | EntryRecord[num_entries] | StrRef[num_subdirs] | blob
+//
+// Native endianness; the file never leaves the machine. Every string in the
+// blob is null-terminated, and blob[0] is '\0' so that empty strings are {0, 0}.
+
+static constexpr char     magic[8] = {'W', 'M', 'A', 'P', 'P', 'I', 'D', 'X'};
+static constexpr uint32_t version  = 3;
+
+struct StrRef {
+	uint32_t offset;
+	uint32_t length;
+};
+
+struct Header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t num_dirs;
+	uint32_t num_entries;
+	uint32_t num_subdirs;
+	uint32_t blob_size;
+	uint32_t reserved;
+};
+
+struct DirRecord {
+	int64_t  mtime_ns;
+	StrRef   path;
+	uint32_t first_entry;
+	uint32_t num_entries;
+	uint32_t first_subdir;
+	uint32_t num_subdirs;
+};
+
+struct EntryRecord {
+	StrRef desktop_file_id;
+	StrRef startup_wm_class;
+	StrRef name;
+	StrRef iconstring; // empty if there is no icon
+	StrRef desktop_file_path;
+};
+
+static std::string get_cache_path()
+{
+	if (auto xdg = std::getenv("XDG_CACHE_HOME"); xdg && xdg[0])
+		return std::format("{}/wm/app-index", xdg);
+	if (auto home = std::getenv("HOME"); home && home[0])
+		return std::format("{}/.cache/wm/app-index", home);
+	return {};
+}
+
+static const Header *header(const char *mapping)
+{ return reinterpret_cast<const Header *>(mapping); }
+
+static const DirRecord *dir_records(const char *mapping)
+{ return reinterpret_cast<const DirRecord *>(mapping + sizeof(Header)); }
+
+static const EntryRecord *entry_records(const char *mapping)
+{
+	return reinterpret_cast<const EntryRecord *>(
+	    mapping + sizeof(Header) + header(mapping)->num_dirs * sizeof(DirRecord)
+	);
+}
+
+static const StrRef *subdir_records(const char *mapping)
+{
+	return reinterpret_cast<const StrRef *>(entry_records(mapping) + header(mapping)->num_entries);
+}
+
+static const char *blob(const char *mapping)
+{
+	return reinterpret_cast<const char *>(subdir_records(mapping) + header(mapping)->num_subdirs);
+}
+
+static bool is_valid(const char *mapping, size_t size)
+{
+	if (size < sizeof(Header)) [[unlikely]]
+		return false;
+
+	const auto *h = header(mapping);
+	if (std::memcmp(h->magic, magic, sizeof(magic)) || h->version != version)
+		return false;
+
+	uint64_t expected_size = sizeof(Header)
+	                         + uint64_t{h->num_dirs} * sizeof(DirRecord)
+	                         + uint64_t{h->num_entries} * sizeof(EntryRecord)
+	                         + uint64_t{h->num_subdirs} * sizeof(StrRef)
+	                         + h->blob_size;
+	if (expected_size != size || !h->blob_size) [[unlikely]]
+		return false;
+
+	const char *b          = blob(mapping);
+	auto        is_in_blob = [&](StrRef s) {
+		return uint64_t{s.offset} + s.length < h->blob_size && b[s.offset + s.length] == '\0';
+	};
+
+	if (b[0] != '\0')
+		return false;
+
+	for (const auto &dir : std::span{dir_records(mapping), h->num_dirs}) {
+		if (!is_in_blob(dir.path)
+		    || uint64_t{dir.first_entry} + dir.num_entries > h->num_entries
+		    || uint64_t{dir.first_subdir} + dir.num_subdirs > h->num_subdirs) [[unlikely]] {
+			return false;
+		}
+	}
+
+	for (const auto &subdir : std::span{subdir_records(mapping), h->num_subdirs}) {
+		if (!is_in_blob(subdir)) [[unlikely]]
+			return false;
+	}
+
+	for (const auto &entry : std::span{entry_records(mapping), h->num_entries}) {
+		if (!is_in_blob(entry.desktop_file_id)
+		    || !is_in_blob(entry.startup_wm_class)
+		    || !is_in_blob(entry.name)
+		    || !is_in_blob(entry.iconstring)
+		    || !is_in_blob(entry.desktop_file_path)) [[unlikely]] {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+namespace wm {
+
+IndexCache::IndexCache() : mapping(nullptr), mapping_size(0) {}
+
+IndexCache::IndexCache(const char *mapping, size_t mapping_size) :
+    mapping(mapping),
+    mapping_size(mapping_size)
+{}
+
+IndexCache::IndexCache(IndexCache &&other) noexcept :
+    mapping(std::exchange(other.mapping, nullptr)),
+    mapping_size(std::exchange(other.mapping_size, 0))
+{}
+
+IndexCache &IndexCache::operator=(IndexCache &&other) noexcept
+{
+	if (this != &other) {
+		if (mapping)
+			munmap(const_cast<char *>(mapping), mapping_size);
+		mapping      = std::exchange(other.mapping, nullptr);
+		mapping_size = std::exchange(other.mapping_size, 0);
+	}
+	return *this;
+}
+
+IndexCache::~IndexCache()
+{
+	if (mapping)
+		munmap(const_cast<char *>(mapping), mapping_size);
+}
+
+IndexCache IndexCache::open()
+{
+	auto path = get_cache_path();
+	if (path.empty()) [[unlikely]]
+		return {};
+
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return {};
+
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size <= 0) [[unlikely]] {
+		close(fd);
+		return {};
+	}
+
+	auto  size = static_cast<size_t>(st.st_size);
+	void *ptr  = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) [[unlikely]]
+		return {};
+
+	IndexCache cache(static_cast<const char *>(ptr), size);
+	if (!is_valid(cache.mapping, size))
+		return {};
+
+	return cache;
+}
+
+std::optional<DirIndex> IndexCache::find(std::string_view dir, int64_t mtime_ns) const
+{
+	if (!mapping || mtime_ns < 0)
+		return std::nullopt;
+
+	const char *b   = blob(mapping);
+	auto        str = [b](StrRef s) { return std::string_view{b + s.offset, s.length}; };
+
+	for (const auto &record : std::span{dir_records(mapping), header(mapping)->num_dirs}) {
+		if (record.mtime_ns != mtime_ns || str(record.path) != dir)
+			continue;
+
+		DirIndex index{
+		    .path     = str(record.path),
+		    .mtime_ns = mtime_ns,
+		    .subdirs  = {},
+		    .entries  = {},
+		};
+		index.subdirs.reserve(record.num_subdirs);
+		for (auto subdir :
+		     std::span{subdir_records(mapping) + record.first_subdir, record.num_subdirs}) {
+			index.subdirs.push_back(str(subdir));
+		}
+		index.entries.reserve(record.num_entries);
+		for (const auto &entry :
+		     std::span{entry_records(mapping) + record.first_entry, record.num_entries}) {
+			index.entries.push_back({
+			    .desktop_file_id   = str(entry.desktop_file_id),
+			    .startup_wm_class  = str(entry.startup_wm_class),
+			    .name              = str(entry.name),
+			    .iconstring        = entry.iconstring.length ? b + entry.iconstring.offset : nullptr,
+			    .desktop_file_path = b + entry.desktop_file_path.offset,
+			});
+		}
+		return index;
+	}
+
+	return std::nullopt;
+}
+
+void IndexCache::write(std::span<const DirIndex> dir_indices)
+{
+	auto path = get_cache_path();
+	if (path.empty()) [[unlikely]]
+		return;
+
+	std::vector<DirRecord>   dir_out;
+	std::vector<EntryRecord> entry_out;
+	std::vector<StrRef>      subdir_out;
+	std::string              blob_out(1, '\0');
+
+	auto save = [&blob_out](std::string_view s) -> StrRef {
+		if (s.empty())
+			return {0, 0};
+		StrRef ref{static_cast<uint32_t>(blob_out.size()), static_cast<uint32_t>(s.length())};
+		blob_out.append(s);
+		blob_out.push_back('\0');
+		return ref;
+	};
+
+	dir_out.reserve(dir_indices.size());
+	for (const auto &index : dir_indices) {
+		if (index.mtime_ns < 0)
+			continue;
+		dir_out.push_back({
+		    .mtime_ns     = index.mtime_ns,
+		    .path         = save(index.path),
+		    .first_entry  = static_cast<uint32_t>(entry_out.size()),
+		    .num_entries  = static_cast<uint32_t>(index.entries.size()),
+		    .first_subdir = static_cast<uint32_t>(subdir_out.size()),
+		    .num_subdirs  = static_cast<uint32_t>(index.subdirs.size()),
+		});
+		for (auto subdir : index.subdirs)
+			subdir_out.push_back(save(subdir));
+		for (const auto &entry : index.entries) {
+			entry_out.push_back({
+			    .desktop_file_id   = save(entry.desktop_file_id),
+			    .startup_wm_class  = save(entry.startup_wm_class),
+			    .name              = save(entry.name),
+			    .iconstring        = save(entry.iconstring ? entry.iconstring : ""),
+			    .desktop_file_path = save(entry.desktop_file_path),
+			});
+		}
+	}
+
+	if (blob_out.size() > std::numeric_limits<uint32_t>::max()) [[unlikely]]
+		return;
+
+	Header h{};
+	std::memcpy(h.magic, magic, sizeof(magic));
+	h.version     = version;
+	h.num_dirs    = static_cast<uint32_t>(dir_out.size());
+	h.num_entries = static_cast<uint32_t>(entry_out.size());
+	h.num_subdirs = static_cast<uint32_t>(subdir_out.size());
+	h.blob_size   = static_cast<uint32_t>(blob_out.size());
+
+	auto parent = llvm::sys::path::parent_path(path);
+	if (llvm::sys::fs::create_directories(parent)) [[unlikely]]
+		return;
+
+	auto tmp_path = path + ".XXXXXX";
+	int  fd       = mkstemp(tmp_path.data());
+	if (fd == -1) [[unlikely]]
+		return;
+
+	auto write_all = [fd](const void *data, size_t size) {
+		const char *ptr = static_cast<const char *>(data);
+		while (size > 0) {
+			auto written = ::write(fd, ptr, size);
+			if (written > 0) {
+				ptr  += written;
+				size -= written;
+			} else if (written == 0 || errno != EINTR) [[unlikely]] {
+				return false;
+			}
+		}
+		return true;
+	};
+
+	bool ok = write_all(&h, sizeof(h))
+	          && write_all(dir_out.data(), dir_out.size() * sizeof(DirRecord))
+	          && write_all(entry_out.data(), entry_out.size() * sizeof(EntryRecord))
+	          && write_all(subdir_out.data(), subdir_out.size() * sizeof(StrRef))
+	          && write_all(blob_out.data(), blob_out.size());
+	close(fd);
+
+	if (!ok || std::rename(tmp_path.c_str(), path.c_str())) [[unlikely]]
+		unlink(tmp_path.c_str());
+}
+
+int64_t get_mtime_ns(const char *path)
+{
+	struct stat st;
+	if (stat(path, &st)) [[unlikely]]
+		return -1;
+	return int64_t{st.st_mtim.tv_sec} * 1'000'000'000 + st.st_mtim.tv_nsec;
+}
+
+} // namespace wm
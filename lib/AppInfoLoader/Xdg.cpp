@@ -3,6 +3,7 @@ module;
 #include "immintrin.h"
 
 #include <errno.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 module wm.AppInfoLoader.Xdg;
@@ -10,25 +11,92 @@ module wm.AppInfoLoader.Xdg;
 import std;
 import wm.Support.ComptimeString;
 
-using std::uint32_t;
+using std::uint32_t, std::uint64_t;
 
 using namespace wm;
 
+// Byte masks, one kernel per instruction set. `load_block` requires
+// `width`-byte alignment.
+//
+// The kernels carry their own target attribute and are only inlined once the
+// parse loop below has been inlined into an entry point with the same target;
+// the templates in between must not use intrinsics themselves.
+
+template <typename Mask>
+struct BlockMasks {
+	Mask newlines;
+	Mask brackets;
+};
+
+struct Sse2 {
+	using mask_t                  = uint32_t;
+	static constexpr size_t width = 16;
+
+	static mask_t eq(__m128i v, char c)
+	{ return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c))); }
+
+	static mask_t load_newlines(const char *s)
+	{ return eq(_mm_loadu_si128(reinterpret_cast<const __m128i *>(s)), '\n'); }
+
+	static BlockMasks<mask_t> load_block(const char *s)
+	{
+		auto v = _mm_load_si128(reinterpret_cast<const __m128i *>(s));
+		return {eq(v, '\n'), eq(v, '[')};
+	}
+};
+
+struct Avx2 {
+	using mask_t                  = uint32_t;
+	static constexpr size_t width = 32;
+
+	[[gnu::target("avx2")]]
+	static mask_t eq(__m256i v, char c)
+	{ return _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c))); }
+
+	[[gnu::target("avx2")]]
+	static mask_t load_newlines(const char *s)
+	{ return eq(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(s)), '\n'); }
+
+	[[gnu::target("avx2")]]
+	static BlockMasks<mask_t> load_block(const char *s)
+	{
+		auto v = _mm256_load_si256(reinterpret_cast<const __m256i *>(s));
+		return {eq(v, '\n'), eq(v, '[')};
+	}
+};
+
+struct Avx512 {
+	using mask_t                  = uint64_t;
+	static constexpr size_t width = 64;
+
+	[[gnu::target("avx512bw")]]
+	static mask_t eq(__m512i v, char c)
+	{ return _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(c)); }
+
+	[[gnu::target("avx512bw")]]
+	static mask_t load_newlines(const char *s)
+	{ return eq(_mm512_loadu_si512(s), '\n'); }
+
+	[[gnu::target("avx512bw")]]
+	static BlockMasks<mask_t> load_block(const char *s)
+	{
+		auto v = _mm512_load_si512(s);
+		return {eq(v, '\n'), eq(v, '[')};
+	}
+};
+
+template <typename Isa>
 [[gnu::always_inline]]
 static inline const char *find_newline(const char *s)
 {
-	const __m256i newline_vec = _mm256_set1_epi8('\n');
 	while (true) {
-		uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
-		    _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s)), newline_vec
-		));
-		if (mask)
-			return s + __builtin_ctz(mask);
-		s += 32;
+		if (auto mask = Isa::load_newlines(s))
+			return s + std::countr_zero(mask);
+		s += Isa::width;
 	}
 }
 
-template <ComptimeString Key>
+template <ComptimeString Key, typename Isa>
 [[gnu::always_inline]]
 static inline std::string_view extract_field(const char *line_start)
 {
@@ -49,7 +117,7 @@ static inline std::string_view extract_field(const char *line_start)
 			++ptr;
 			if (*ptr == ' ') [[unlikely]]
 				++ptr;
-			return std::string_view{ptr, static_cast<size_t>(find_newline(ptr) - ptr)};
+			return std::string_view{ptr, static_cast<size_t>(find_newline<Isa>(ptr) - ptr)};
 		}
 	}
 	return {};
@@ -63,28 +131,42 @@ constexpr uint32_t fourcc(const char (&s)[5])
 	       | (static_cast<uint32_t>(s[3]) << 24);
 }
 
-namespace wm {
-
 // Extracts Name, Icon, and StartupWMClass from a desktop file.
 // Does as little as possible; does not even verify if the desktop file is
 // well-formed.
-DesktopFileInfo get_desktop_file_info(const char *data, int size)
+//
+// Stops at the next group header: keys of other groups (e.g. the Name of a
+// [Desktop Action]) must not be picked up, and most files do not have all
+// three keys, so this is usually where parsing ends.
+template <typename Isa>
+[[gnu::always_inline]]
+static inline DesktopFileInfo parse_desktop_file(const char *data, int size)
 {
+	using mask_t = Isa::mask_t;
+
 	if (size <= 16 || std::string_view{data, 16} != "[Desktop Entry]\n") [[unlikely]]
 		return {};
 
 	DesktopFileInfo info{};
-	const __m256i   newline_vec = _mm256_set1_epi8('\n');
 
-	int remaining_keys = 3;
+	int    remaining_keys = 3;
+	mask_t carry          = 0; // whether the previous block ended with '\n'
+
+	for (int i = 0; i < size; i += Isa::width) {
+		auto [mask, brackets] = Isa::load_block(data + i);
 
-	for (int i = 0; i < size; i += 32) {
-		uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
-		    _mm256_load_si256(reinterpret_cast<const __m256i *>(data + i)), newline_vec
-		));
+		// bit k set iff a line starts with '[' at data + i + k
+		mask_t group_starts = ((mask << 1) | carry) & brackets;
+		carry               = mask >> (Isa::width - 1);
+
+		if (group_starts) [[unlikely]] {
+			// keep only the newlines before the header's own
+			auto header = std::countr_zero(group_starts);
+			mask        = header ? mask & ((mask_t{1} << (header - 1)) - 1) : 0;
+		}
 
 		while (mask) {
-			const char *line_start = data + i + __builtin_ctz(mask) + 1;
+			const char *line_start = data + i + std::countr_zero(mask) + 1;
 
 			mask &= (mask - 1);
 
@@ -97,7 +179,7 @@ DesktopFileInfo get_desktop_file_info(const char *data, int size)
 			switch (prefix) {
 			case fourcc("Icon"):
 				if (info.iconstring.empty()) {
-					if (auto val = extract_field<"Icon">(line_start); !val.empty()) {
+					if (auto val = extract_field<"Icon", Isa>(line_start); !val.empty()) {
 						info.iconstring = val;
 						remaining_keys -= 1;
 					}
@@ -106,7 +188,7 @@ DesktopFileInfo get_desktop_file_info(const char *data, int size)
 
 			case fourcc("Name"):
 				if (info.name.empty()) {
-					if (auto val = extract_field<"Name">(line_start); !val.empty()) {
+					if (auto val = extract_field<"Name", Isa>(line_start); !val.empty()) {
 						info.name       = val;
 						remaining_keys -= 1;
 					}
@@ -115,7 +197,8 @@ DesktopFileInfo get_desktop_file_info(const char *data, int size)
 
 			case fourcc("Star"):
 				if (info.startup_wm_class.empty()) {
-					if (auto val = extract_field<"StartupWMClass">(line_start); !val.empty()) {
+					auto val = extract_field<"StartupWMClass", Isa>(line_start);
+					if (!val.empty()) {
 						info.startup_wm_class = val;
 						remaining_keys       -= 1;
 					}
@@ -126,40 +209,122 @@ DesktopFileInfo get_desktop_file_info(const char *data, int size)
 			if (!remaining_keys)
 				return info;
 		}
+
+		if (group_starts) [[unlikely]]
+			return info;
 	}
 
 	return info;
 }
 
-std::pair<unique_aligned_ptr, int> read_desktop_file(int fd)
+static DesktopFileInfo parse_desktop_file_sse2(const char *data, int size)
+{ return parse_desktop_file<Sse2>(data, size); }
+
+[[gnu::target("avx2")]]
+static DesktopFileInfo parse_desktop_file_avx2(const char *data, int size)
+{ return parse_desktop_file<Avx2>(data, size); }
+
+[[gnu::target("avx512bw")]]
+static DesktopFileInfo parse_desktop_file_avx512(const char *data, int size)
+{ return parse_desktop_file<Avx512>(data, size); }
+
+static SimdLevel detect_simd_level()
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512bw"))
+		return SimdLevel::AVX512BW;
+	if (__builtin_cpu_supports("avx2"))
+		return SimdLevel::AVX2;
+	return SimdLevel::SSE2;
+}
+
+static auto select_parser(SimdLevel level)
+{
+	switch (level) {
+	case SimdLevel::AVX512BW: return parse_desktop_file_avx512;
+	case SimdLevel::AVX2:     return parse_desktop_file_avx2;
+	case SimdLevel::SSE2:     return parse_desktop_file_sse2;
+	}
+	std::unreachable();
+}
+
+namespace wm {
+
+SimdLevel get_simd_level()
 {
-	auto size = lseek(fd, 0, SEEK_END);
-	if (size <= 0 || lseek(fd, 0, SEEK_SET) < 0) [[unlikely]]
-		return {unique_aligned_ptr(nullptr, aligned_deleter), 0};
+	static const SimdLevel level = detect_simd_level();
+	return level;
+}
 
-	int                alloc_size = (size + 64 + 31) & ~31;
+DesktopFileInfo get_desktop_file_info(const char *data, int size)
+{
+	static const auto parse = select_parser(get_simd_level());
+	return parse(data, size);
+}
+
+DesktopFileInfo get_desktop_file_info(const char *data, int size, SimdLevel level)
+{ return select_parser(level)(data, size); }
+
+unique_aligned_ptr make_desktop_file_buffer(int size)
+{
+	constexpr int      align      = desktop_file_alignment;
+	int                alloc_size = (size + align + align - 1) & ~(align - 1);
 	unique_aligned_ptr buffer(
-	    static_cast<char *>(::operator new[](alloc_size, std::align_val_t{32})), aligned_deleter
+	    static_cast<char *>(::operator new[](alloc_size, std::align_val_t{desktop_file_alignment}))
 	);
+	// the parser loads whole blocks past the end
+	std::memset(buffer.get() + size, '\n', alloc_size - size);
+	return buffer;
+}
 
-	char *ptr       = buffer.get();
-	int   remaining = static_cast<int>(size);
-
-	while (remaining > 0) {
-		auto bytes_read = read(fd, ptr, remaining);
+static bool pread_all(int fd, char *ptr, int length, int offset)
+{
+	while (length > 0) {
+		auto bytes_read = pread(fd, ptr, length, offset);
 		if (bytes_read > 0) {
-			ptr       += bytes_read;
-			remaining -= bytes_read;
+			ptr    += bytes_read;
+			length -= bytes_read;
+			offset += bytes_read;
 		} else if (bytes_read == 0 || errno != EINTR) [[unlikely]] {
-			return {unique_aligned_ptr(nullptr, aligned_deleter), 0};
+			return false;
 		}
 	}
+	return true;
+}
 
-	std::memset(buffer.get() + size, '\n', alloc_size - size);
+bool has_complete_desktop_entry(const char *data, int length, int size)
+{
+	// the parser stops at the first line starting with '['
+	return length == size || std::string_view{data, static_cast<size_t>(length)}.contains("\n[");
+}
 
+std::pair<unique_aligned_ptr, int>
+read_desktop_file_rest(int fd, unique_aligned_ptr prefix, int length, int size)
+{
+	auto buffer = make_desktop_file_buffer(size);
+	std::memcpy(buffer.get(), prefix.get(), length);
+	if (!pread_all(fd, buffer.get() + length, size - length, length)) [[unlikely]]
+		return {unique_aligned_ptr(), 0};
 	return {std::move(buffer), size};
 }
 
+std::pair<unique_aligned_ptr, int> read_desktop_file(int fd)
+{
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size <= 0 || st.st_size > max_desktop_file_size) [[unlikely]]
+		return {unique_aligned_ptr(), 0};
+
+	int  size   = static_cast<int>(st.st_size);
+	int  length = std::min(size, desktop_file_prefix_size);
+	auto buffer = make_desktop_file_buffer(length);
+	if (!pread_all(fd, buffer.get(), length, 0)) [[unlikely]]
+		return {unique_aligned_ptr(), 0};
+
+	if (has_complete_desktop_entry(buffer.get(), length, size)) [[likely]]
+		return {std::move(buffer), length};
+	return read_desktop_file_rest(fd, std::move(buffer), length, size);
+}
+
 XdgAppDirs get_xdg_app_dirs()
 {
 	XdgAppDirs app_dirs;
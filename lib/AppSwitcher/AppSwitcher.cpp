@@ -1,6 +1,5 @@
 module;
 
-#include <GLES3/gl32.h>
 #include <cassert>
 #include <wayland-server-core.h>
 
@@ -52,13 +51,16 @@ AppSwitcher::AppSwitcher(const AppSwitcherConfig &config) :
     app_id_focus_history(nullptr),
     app_stuff_map(nullptr),
     timer(nullptr),
+    upload_idle(nullptr),
     active(false),
     visible(false),
     dirty(false),
     idx(0),
+    first_row(0),
     max_entries(20),
     config(config)
 {
+	app_icon_paths.reserve(max_entries);
 	icon_texture_cache.reserve(max_entries);
 	load_config();
 }
@@ -99,6 +101,8 @@ void AppSwitcher::load_config()
 	icon_size = config.icon_size->value();
 	icon_sep  = config.icon_sep->value();
 
+	layouts.clear();
+
 	auto make_texture = [](const CHyprColor &color) {
 		auto to_byte = [](double value) {
 			return static_cast<uint8_t>(std::lround(std::clamp(value, 0.0, 1.0) * 255.0));
@@ -144,8 +148,8 @@ void AppSwitcher::activate(
 		    g_pCompositor->m_wlEventLoop,
 		    [](void *data) {
 			    auto *self = static_cast<AppSwitcher *>(data);
-			    if (auto res = self->get_container_box(); res.has_value())
-				    g_pHyprRenderer->damageRegion(res.value());
+			    if (const auto *layout = self->get_layout())
+				    self->damage(*layout, layout->outer_box);
 			    return 0;
 		    },
 		    this
@@ -155,17 +159,27 @@ void AppSwitcher::activate(
 
 	log<LogLevel::TRACE, "show: {}">(*app_id_focus_history);
 	this->idx                  = 0;
+	this->first_row            = 0;
 	this->app_id_focus_history = app_id_focus_history;
 	this->app_stuff_map        = app_stuff_map;
 
-	if (!dirty) [[likely]]
+	if (!dirty) [[likely]] {
 		load_icon_textures();
+		// the icons at the start of the switcher have to be there first
+		app_info_loader.prioritize_icons(*app_id_focus_history);
+	}
 }
 
 bool AppSwitcher::is_active() const { return active; }
 
 void AppSwitcher::highlight_next(bool backwards)
 {
+	std::optional<CBox> prev_selection_box;
+	if (visible && !dirty) {
+		if (const auto *layout = get_layout())
+			prev_selection_box = get_selection_box(*layout);
+	}
+
 	if (!backwards) {
 		idx++;
 		if (idx == static_cast<int>(app_id_focus_history->size()))
@@ -181,8 +195,24 @@ void AppSwitcher::highlight_next(bool backwards)
 	    (idx >= 0 && idx < static_cast<int>(app_id_focus_history->size())) && "idx out of bounds"
 	);
 
-	if (auto monitor = Desktop::focusState()->monitor()) [[likely]]
-		g_pHyprRenderer->damageMonitor(monitor);
+	// the next frame draws the switcher for the first time anyway
+	if (!visible || dirty)
+		return;
+	const auto *layout = get_layout();
+	if (!layout) [[unlikely]]
+		return;
+
+	// only the old and the new selection change, unless the rows scroll
+	auto prev_first_row = first_row;
+	scroll_to_selection(*layout);
+	if (first_row != prev_first_row) {
+		damage(*layout, layout->container_box);
+		return;
+	}
+	if (prev_selection_box)
+		damage(*layout, *prev_selection_box);
+	if (auto selection_box = get_selection_box(*layout))
+		damage(*layout, *selection_box);
 }
 
 void AppSwitcher::focus_selected()
@@ -199,14 +229,18 @@ void AppSwitcher::focus_selected()
 void AppSwitcher::deactivate()
 {
 	if (visible) {
-		if (auto box = get_container_box(); box.has_value())
-			g_pHyprRenderer->damageRegion(*box);
+		if (const auto *layout = get_layout())
+			damage(*layout, layout->outer_box);
 	}
 
 	if (timer) [[likely]] {
 		wl_event_source_remove(timer);
 		timer = nullptr;
 	}
+	if (upload_idle) {
+		wl_event_source_remove(upload_idle);
+		upload_idle = nullptr;
+	}
 	active  = false;
 	visible = false;
 }
@@ -228,42 +262,120 @@ void AppSwitcher::on_close_app(const char *closing_app_id)
 	}
 }
 
-std::expected<CBox, std::monostate> AppSwitcher::get_container_box() const
+const SwitcherLayout *AppSwitcher::get_layout()
 {
-	auto num_icons    = app_id_focus_history->size();
-	auto total_width  = container_padding * 2 + icon_size * num_icons + icon_sep * (num_icons - 1);
-	auto total_height = 2 * container_padding + icon_size;
-	auto monitor      = Desktop::focusState()->monitor();
+	auto monitor = Desktop::focusState()->monitor();
 	if (!monitor) [[unlikely]] {
-		log<LogLevel::DEBUG, "monitor {} is null">(Desktop::focusState()->monitor().get());
-		return std::unexpected{std::monostate{}};
+		log<LogLevel::DEBUG, "monitor {} is null">(monitor.get());
+		return nullptr;
 	}
-	auto center = monitor->m_size * monitor->m_scale / 2;
-	return CBox(
-	    center.x - total_width / 2.0, center.y - total_height / 2.0, total_width, total_height
-	);
+
+	auto &layout            = layouts[monitor.get()];
+	auto  num_icons         = app_id_focus_history->size();
+	// moving the monitor only moves where the layout is damaged
+	layout.monitor_position = monitor->m_position;
+	if (layout.monitor_size != monitor->m_size || layout.monitor_scale != monitor->m_scale
+	    || layout.num_icons != num_icons) [[unlikely]] {
+		update_layout(layout, monitor->m_size, monitor->m_scale, num_icons);
+	}
+	return &layout;
 }
 
-CBox AppSwitcher::get_shadow_box(
-    const CBox &container_box, const ShadowConfig &shadow, double monitor_scale
+void AppSwitcher::update_layout(
+    SwitcherLayout &layout, const Vector2D &monitor_size, double monitor_scale, size_t num_icons
 ) const
 {
-	auto box = container_box.copy();
-	box.expand(container_border_width * monitor_scale);
-	box.expand(shadow.range * monitor_scale);
-	box.scaleFromCenter(std::clamp(shadow.scale, 0.F, 1.F));
-	box.translate(shadow.offset * monitor_scale);
-	return box;
+	layout.monitor_size  = monitor_size;
+	layout.monitor_scale = monitor_scale;
+	layout.num_icons     = num_icons;
+	if (!layout.icon_layer)
+		layout.icon_layer = std::make_unique<IconLayer>();
+
+	// as many cells as fit in `max_monitor_fraction` of the monitor, at least one
+	auto cell_size = icon_size + icon_sep;
+	auto fit       = [&](double extent) {
+		auto space = extent * max_monitor_fraction - 2 * container_padding + icon_sep;
+		return static_cast<size_t>(std::max(std::floor(space / cell_size), 1.0));
+	};
+	auto monitor_pixels = monitor_size * monitor_scale;
+	layout.columns      = std::min(fit(monitor_pixels.x), std::max(num_icons, 1uz));
+	layout.num_rows     = (num_icons + layout.columns - 1) / layout.columns;
+	layout.rows         = std::min(fit(monitor_pixels.y), std::max(layout.num_rows, 1uz));
+
+	auto columns      = static_cast<double>(layout.columns);
+	auto rows         = static_cast<double>(layout.rows);
+	auto total_width  = container_padding * 2 + icon_size * columns + icon_sep * (columns - 1);
+	auto total_height = container_padding * 2 + icon_size * rows + icon_sep * (rows - 1);
+	auto center       = monitor_pixels / 2;
+	auto &container   = layout.container_box;
+	container         = CBox(
+        center.x - total_width / 2.0, center.y - total_height / 2.0, total_width, total_height
+    );
+
+	layout.icon_boxes.resize(layout.columns * layout.rows);
+	for (auto [i, box] : layout.icon_boxes | std::views::enumerate) {
+		auto column = static_cast<double>(static_cast<size_t>(i) % layout.columns);
+		auto row    = static_cast<double>(static_cast<size_t>(i) / layout.columns);
+		box.x       = container.x + container_padding + column * cell_size;
+		box.y       = container.y + container_padding + row * cell_size;
+		box.w       = icon_size;
+		box.h       = icon_size;
+	}
+
+	layout.border_size = std::max(1, static_cast<int>(std::round(container_border_width)));
+	layout.has_shadow =
+	    shadow.enabled && shadow.range > 0 && shadow.scale > 0.F && shadow.color.a > 0.0;
+	if (layout.has_shadow) {
+		auto &box = layout.shadow_box;
+		box       = container.copy();
+		box.expand(container_border_width * monitor_scale);
+		box.expand(shadow.range * monitor_scale);
+		box.scaleFromCenter(std::clamp(shadow.scale, 0.F, 1.F));
+		box.translate(shadow.offset * monitor_scale);
+		layout.shadow_range = static_cast<int>(std::round(shadow.range * monitor_scale));
+		layout.shadow_round = static_cast<int>(
+		    std::round(container_radius + container_border_width * monitor_scale)
+		);
+		layout.outer_box = box;
+	} else {
+		layout.outer_box = container.copy().expand(container_border_width * monitor_scale);
+	}
 }
 
-std::vector<CUniquePointer<IPassElement>> AppSwitcher::render()
+std::optional<CBox> AppSwitcher::get_selection_box(const SwitcherLayout &layout) const
 {
-	auto monitor = Desktop::focusState()->monitor();
-	if (!monitor) [[unlikely]] {
-		log<LogLevel::DEBUG, "monitor {} is null">(Desktop::focusState()->monitor().get());
-		return {};
-	}
+	auto cell = static_cast<size_t>(idx) - first_row * layout.columns;
+	if (cell >= layout.icon_boxes.size()) [[unlikely]]
+		return std::nullopt;
+	return layout.icon_boxes[cell].copy().expand(selection_padding);
+}
+
+void AppSwitcher::damage(const SwitcherLayout &layout, const CBox &box) const
+{
+	// to whole logical pixels, rounding outwards, so that no partly covered
+	// pixel is missed under fractional scaling
+	auto x0 = std::floor(box.x / layout.monitor_scale);
+	auto y0 = std::floor(box.y / layout.monitor_scale);
+	auto x1 = std::ceil((box.x + box.w) / layout.monitor_scale);
+	auto y1 = std::ceil((box.y + box.h) / layout.monitor_scale);
+	g_pHyprRenderer->damageRegion(
+	    CBox(x0, y0, x1 - x0, y1 - y0).translate(layout.monitor_position)
+	);
+}
+
+void AppSwitcher::scroll_to_selection(const SwitcherLayout &layout)
+{
+	auto row = static_cast<size_t>(idx) / layout.columns;
+	if (row < first_row)
+		first_row = row;
+	else if (row >= first_row + layout.rows)
+		first_row = row - layout.rows + 1;
+	// closed apps or a larger monitor can leave rows empty at the end
+	first_row = std::min(first_row, std::max(layout.num_rows, layout.rows) - layout.rows);
+}
 
+std::vector<CUniquePointer<IPassElement>> AppSwitcher::render()
+{
 	if (dirty) [[unlikely]]
 		return {};
 
@@ -273,12 +385,10 @@ std::vector<CUniquePointer<IPassElement>> AppSwitcher::render()
 		visible = true;
 	}
 
-	// TODO: cache for each monitor and recalc when monitor changes
-	CBox container_box;
-	if (auto res = get_container_box(); res.has_value())
-		container_box = res.value();
-	else
+	const auto *layout = get_layout();
+	if (!layout) [[unlikely]]
 		return {};
+	const auto &container_box = layout->container_box;
 
 	std::vector<CUniquePointer<IPassElement>> elements;
 	auto append_surface = [&elements](const SolidSurface &surface, const CBox &box, int round) {
@@ -294,25 +404,23 @@ std::vector<CUniquePointer<IPassElement>> AppSwitcher::render()
 		elements.emplace_back(makeUnique<CTexPassElement>(std::move(data)));
 	};
 
-	if (shadow.enabled && shadow.range > 0 && shadow.scale > 0.F && shadow.color.a > 0.0) {
-		// TODO: cache for each monitor and recalc when monitor changes
-		auto shadow_box   = get_shadow_box(container_box, shadow, monitor->m_scale);
-		auto shadow_range = static_cast<int>(std::round(shadow.range * monitor->m_scale));
-		auto shadow_round = static_cast<int>(
-		    std::round(container_radius + container_border_width * monitor->m_scale)
-		);
-
+	if (layout->has_shadow) {
 		if (shadow.sharp) {
 			CBorderPassElement::SBorderData data;
-			data.box        = shadow_box.copy().expand(-shadow_range);
+			data.box        = layout->shadow_box.copy().expand(-layout->shadow_range);
 			data.grad1      = Config::CGradientValueData{shadow.color};
-			data.round      = shadow_round;
-			data.outerRound = shadow_round;
+			data.round      = layout->shadow_round;
+			data.outerRound = layout->shadow_round;
 			data.borderSize = shadow.range;
 			elements.emplace_back(makeUnique<CBorderPassElement>(std::move(data)));
 		} else {
 			g_pHyprRenderer->drawShadow(
-			    shadow_box, shadow_round, 2.F, shadow_range, shadow.color, 1.F
+			    layout->shadow_box,
+			    layout->shadow_round,
+			    2.F,
+			    layout->shadow_range,
+			    shadow.color,
+			    1.F
 			);
 		}
 	}
@@ -325,164 +433,255 @@ std::vector<CUniquePointer<IPassElement>> AppSwitcher::render()
 		data.grad1      = container_border_gradient;
 		data.round      = container_radius;
 		data.outerRound = container_radius;
-		data.borderSize = std::max(1, static_cast<int>(std::round(container_border_width)));
+		data.borderSize = layout->border_size;
 		elements.emplace_back(makeUnique<CBorderPassElement>(std::move(data)));
 	}
 
-	// TODO: use multiple rows when too many icons
-	double icon_x   = container_box.x + container_padding;
-	double icon_y   = container_box.y + container_padding;
-	CBox   icon_box = {icon_x, icon_y, icon_size, icon_size};
-	for (const auto &[i, app_id] : *app_id_focus_history | std::views::enumerate) {
-		if (i == idx) {
-			CBox selection_box = {
-			    icon_x - selection_padding,
-			    icon_y - selection_padding,
-			    icon_size + 2 * selection_padding,
-			    icon_size + 2 * selection_padding
-			};
-
+	// only the rows around the selection get pass elements and uploads, so
+	// a frame costs the same however many apps there are
+	scroll_to_selection(*layout);
+	auto first_visible = first_row * layout->columns;
+	auto visible_ids   = std::span(*app_id_focus_history).subspan(first_visible);
+	visible_ids = visible_ids.first(std::min(visible_ids.size(), layout->icon_boxes.size()));
+
+	std::vector<AtlasQuad> quads;
+	quads.reserve(visible_ids.size());
+	for (const auto &[i, app_id] : visible_ids | std::views::enumerate) {
+		const auto &icon_box = layout->icon_boxes[i];
+		if (first_visible + i == static_cast<size_t>(idx)) {
+			auto selection_box = icon_box.copy().expand(selection_padding);
 			append_surface(selection_surface, selection_box, selection_radius);
 		}
 
 		auto &[_, app_stuff] = *app_stuff_map->find(app_id); // must exist
 		auto app_name        = app_stuff.app_name;
-		auto texture_ptr = std::get_if<CSharedPointer<Render::ITexture>>(&app_stuff.icon_texture);
-		if (!texture_ptr) [[unlikely]] {
+		if (auto slot = std::get_if<AtlasSlot>(&app_stuff.icon_texture)) [[likely]] {
+			quads.push_back({.box = icon_box, .slot = *slot});
+		} else if (std::holds_alternative<IconPending>(app_stuff.icon_texture)) {
 			log<LogLevel::TRACE, "AppSwitcher: data not available for class={}">(app_id);
-			icon_x     += icon_size + icon_sep;
-			icon_box.x += icon_size + icon_sep;
-			continue;
-		}
-		auto icon_texture = *texture_ptr;
-
-		if (icon_texture && icon_texture->m_texID) [[likely]] {
-			CTexPassElement::SRenderData data;
-			data.tex = icon_texture;
-			data.box = icon_box;
-			elements.emplace_back(makeUnique<CTexPassElement>(std::move(data)));
+			quads.push_back({.box = icon_box, .slot = icon_atlas.get_placeholder()});
 		} else {
 			log<LogLevel::DEBUG, "AppSwitcher: icon not available for {}">(app_name);
 		}
+	}
 
-		icon_box.x += icon_size + icon_sep;
-		icon_x     += icon_size + icon_sep;
+	// the strip uploads a few icons per frame, so more frames are needed
+	// until it has uploaded all of them
+	bool pending_uploads = icon_atlas.has_pending_uploads(quads);
+
+	// the selection is drawn below every icon, so one element can draw them
+	// all, from a layer that is only redrawn when the visible icons change
+	if (!quads.empty()) [[likely]] {
+		elements.emplace_back(makeUnique<IconStripPassElement>(
+		    &icon_atlas, layout->icon_layer.get(), std::move(quads), container_box
+		));
+	}
+
+	if (pending_uploads && !upload_idle) {
+		upload_idle = wl_event_loop_add_idle(
+		    g_pCompositor->m_wlEventLoop,
+		    [](void *data) {
+			    auto *self        = static_cast<AppSwitcher *>(data);
+			    self->upload_idle = nullptr;
+			    if (!self->visible)
+				    return;
+			    if (const auto *layout = self->get_layout())
+				    self->damage(*layout, layout->container_box);
+		    },
+		    this
+		);
 	}
 
 	return elements;
 }
 
+/// What an app with icon `shared` shows.
+static IconState get_icon_state(const SharedIcon &shared)
+{
+	return std::visit(
+	    [](const auto &value) -> IconState {
+		    using T = std::decay_t<decltype(value)>;
+		    if constexpr (std::is_same_v<T, std::monostate>)
+			    return {};
+		    else if constexpr (std::is_same_v<T, std::shared_future<Image>>)
+			    return IconPending{};
+		    else if constexpr (std::is_same_v<T, AtlasSlot>)
+			    return value;
+	    },
+	    shared.icon
+	);
+}
+
+// Completions normally arrive through `on_icons_ready`. This catches those
+// whose event has not been dispatched yet.
 void AppSwitcher::load_icon_textures()
 {
 	for (auto &[app_id, app_stuff] : *app_stuff_map) {
-		if (std::holds_alternative<CSharedPointer<Render::ITexture>>(app_stuff.icon_texture)
-		    || std::holds_alternative<std::monostate>(app_stuff.icon_texture)) {
+		if (!std::holds_alternative<IconPending>(app_stuff.icon_texture))
 			continue;
-		}
 
-		auto it = icon_texture_cache.find(app_id);
-		if (it == icon_texture_cache.end()) [[unlikely]]
+		auto path_it = app_icon_paths.find(app_id);
+		if (path_it == app_icon_paths.end() || !path_it->second) [[unlikely]]
 			continue;
+		auto &shared = icon_texture_cache.find(path_it->second)->second;
+		upload_icon(shared);
+		app_stuff.icon_texture = get_icon_state(shared);
+	}
+}
 
-		auto *future = std::get_if<std::future<Image>>(&it->second);
-		if (!future)
-			continue;
+void AppSwitcher::on_icons_ready(
+    std::span<const char *const>                 app_id_focus_history,
+    absl::flat_hash_map<const char *, AppStuff> &app_stuff_map
+)
+{
+	auto icon_paths = app_info_loader.take_ready_icons();
+	for (auto *icon_path : icon_paths) {
+		// released while decoding
+		if (auto it = icon_texture_cache.find(icon_path); it != icon_texture_cache.end())
+			upload_icon(it->second);
+	}
+	for (const auto *app_id : prefetched_app_ids) {
+		if (!app_icon_paths.contains(app_id)) [[unlikely]]
+			auto _ = load_app_icon(app_id, AppInfoLoader::lowest_icon_priority);
+	}
 
-		if (future->wait_for(0s) != std::future_status::ready) [[unlikely]]
-			continue;
+	const SwitcherLayout *layout = visible && !dirty ? get_layout() : nullptr;
 
-		auto icon = future->get();
-		if (!icon.buffer) [[unlikely]] {
-			it->second             = std::monostate{};
-			app_stuff.icon_texture = std::monostate{};
+	for (const auto &[i, app_id] : app_id_focus_history | std::views::enumerate) {
+		auto stuff_it = app_stuff_map.find(app_id);
+		if (stuff_it == app_stuff_map.end()
+		    || !std::holds_alternative<IconPending>(stuff_it->second.icon_texture)) {
 			continue;
 		}
-
-		auto texture    = g_pHyprRenderer->createTexture();
-		texture->m_size = {static_cast<double>(icon.width), static_cast<double>(icon.height)};
-
-		glGenTextures(1, &texture->m_texID);
-		glBindTexture(GL_TEXTURE_2D, texture->m_texID);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-		auto format = icon.format != ImageFormat::RGB ? GL_RGBA : GL_RGB;
-		switch (icon.format) {
-		case ImageFormat::RGB:  format = GL_RGB; break;
-		case ImageFormat::BGRA: [[fallthrough]]; // swizzling done later
-		case ImageFormat::RGBA: format = GL_RGBA; break;
-		}
-		glTexImage2D(
-		    GL_TEXTURE_2D,
-		    0,
-		    format,
-		    icon.width,
-		    icon.height,
-		    0,
-		    format,
-		    GL_UNSIGNED_BYTE,
-		    icon.buffer.get()
-		);
-		if (icon.format == ImageFormat::BGRA) {
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_R, GL_BLUE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, GL_GREEN);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_RED);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_A, GL_ALPHA);
+		IconState state;
+		if (auto path_it = app_icon_paths.find(app_id); path_it == app_icon_paths.end()) {
+			// its icon path had to wait for the loader
+			state = load_app_icon(app_id, static_cast<uint32_t>(i));
+		} else if (std::ranges::contains(icon_paths, path_it->second)) {
+			state = get_icon_state(icon_texture_cache.find(path_it->second)->second);
+		} else {
+			continue;
 		}
-		glBindTexture(GL_TEXTURE_2D, 0);
+		if (std::holds_alternative<IconPending>(state))
+			continue;
+		stuff_it->second.icon_texture = std::move(state);
+		if (!layout)
+			continue;
+		// wraps around for icons scrolled out above the visible rows
+		auto cell = static_cast<size_t>(i) - first_row * layout->columns;
+		if (cell < layout->icon_boxes.size())
+			damage(*layout, layout->icon_boxes[cell]);
+	}
+}
 
-		it->second             = texture;
-		app_stuff.icon_texture = texture;
+void AppSwitcher::upload_icon(SharedIcon &shared)
+{
+	// a decode of the same path may finish after its app re-requested it
+	auto *future = std::get_if<std::shared_future<Image>>(&shared.icon);
+	if (!future || future->wait_for(0s) != std::future_status::ready)
+		return;
+
+	const auto &icon = future->get();
+	if (!icon.buffer) [[unlikely]] {
+		shared.icon = std::monostate{};
+		return;
 	}
+
+	if (auto slot = icon_atlas.add(icon)) [[likely]]
+		shared.icon = *slot;
+	else
+		shared.icon = std::monostate{};
 }
 
-std::variant<std::monostate, IconPending, CSharedPointer<Render::ITexture>>
-AppSwitcher::load_app_icon(const char *app_id)
+IconState AppSwitcher::load_app_icon(const char *app_id, uint32_t priority)
 {
-	auto [it, inserted] = icon_texture_cache.try_emplace(app_id, std::monostate{});
+	auto [it, inserted] = app_icon_paths.try_emplace(app_id, nullptr);
 	if (inserted) {
-		if (auto icon = app_info_loader.get_app_icon(app_id)) [[likely]] {
-			it->second = std::move(*icon);
+		auto icon_path = app_info_loader.get_app_icon_path(app_id);
+		// asked again by `on_icons_ready`
+		if (!icon_path) [[unlikely]] {
+			app_icon_paths.erase(it);
 			return IconPending{};
 		}
+		it->second = *icon_path;
+	}
+	if (!it->second) [[unlikely]]
 		return {};
+
+	auto [icon_it, icon_inserted] =
+	    icon_texture_cache.try_emplace(it->second, SharedIcon{.icon = {}, .users = 0});
+	auto &shared = icon_it->second;
+	if (inserted)
+		shared.users++;
+	if (icon_inserted) {
+		shared.icon = app_info_loader.load_icon(it->second, priority);
+		return IconPending{};
+	}
+	return get_icon_state(shared);
+}
+
+void AppSwitcher::prefetch_app_icons(std::span<const char *const> app_ids)
+{
+	prefetched_app_ids.clear();
+	for (const auto *app_id : app_ids) {
+		prefetched_app_ids.insert(app_id);
+		auto _ = load_app_icon(app_id, AppInfoLoader::lowest_icon_priority);
 	}
-	return std::visit(
-	    [](auto &value)
-	        -> std::variant<std::monostate, IconPending, CSharedPointer<Render::ITexture>> {
-		    using T = std::decay_t<decltype(value)>;
-		    if constexpr (std::is_same_v<T, std::monostate>)
-			    return {};
-		    else if constexpr (std::is_same_v<T, std::future<Image>>)
-			    return IconPending{};
-		    else if constexpr (std::is_same_v<T, CSharedPointer<Render::ITexture>>)
-			    return value;
-	    },
-	    it->second
-	);
+}
+
+void AppSwitcher::release_app_icon(const char *icon_path)
+{
+	if (!icon_path)
+		return;
+	auto it = icon_texture_cache.find(icon_path);
+	if (--it->second.users)
+		return;
+	if (std::holds_alternative<std::shared_future<Image>>(it->second.icon))
+		app_info_loader.cancel_icon(icon_path);
+	else if (auto *slot = std::get_if<AtlasSlot>(&it->second.icon))
+		icon_atlas.remove(*slot);
+	icon_texture_cache.erase(it);
 }
 
 void AppSwitcher::prune_cache(std::span<const char *> app_ids_to_keep)
 {
-	max_entries = std::max(20uz, app_ids_to_keep.size() + app_ids_to_keep.size() / 4);
-	if (icon_texture_cache.size() <= max_entries) [[likely]]
+	auto is_kept = [&](const char *app_id) {
+		return std::ranges::contains(app_ids_to_keep, app_id)
+		    || prefetched_app_ids.contains(app_id);
+	};
+	auto num_kept = app_ids_to_keep.size() + prefetched_app_ids.size();
+
+	// icons of closed apps that are still decoding would never be shown
+	for (auto it = app_icon_paths.begin(); it != app_icon_paths.end();) {
+		auto icon_it = it->second ? icon_texture_cache.find(it->second) : icon_texture_cache.end();
+		if (icon_it != icon_texture_cache.end()
+		    && std::holds_alternative<std::shared_future<Image>>(icon_it->second.icon)
+		    && !is_kept(it->first)) {
+			release_app_icon(it->second);
+			app_icon_paths.erase(it++);
+		} else {
+			++it;
+		}
+	}
+
+	max_entries = std::max(20uz, num_kept + num_kept / 4);
+	if (app_icon_paths.size() <= max_entries) [[likely]]
 		return;
 
-	size_t size_before_pruning = icon_texture_cache.size();
-	for (auto it = icon_texture_cache.begin(); it != icon_texture_cache.end();) {
-		if (icon_texture_cache.size() == std::max(20uz, app_ids_to_keep.size()))
+	size_t size_before_pruning = app_icon_paths.size();
+	for (auto it = app_icon_paths.begin(); it != app_icon_paths.end();) {
+		if (app_icon_paths.size() == std::max(20uz, num_kept))
 			break;
-		if (!std::ranges::contains(app_ids_to_keep, it->first))
-			icon_texture_cache.erase(it++);
-		else
+		if (!is_kept(it->first)) {
+			release_app_icon(it->second);
+			app_icon_paths.erase(it++);
+		} else {
 			++it;
+		}
 	}
 
-	if (icon_texture_cache.size() * 2 < size_before_pruning
-	    && icon_texture_cache.size() <= max_entries) {
+	if (app_icon_paths.size() * 2 < size_before_pruning && app_icon_paths.size() <= max_entries) {
+		app_icon_paths = decltype(app_icon_paths)(app_icon_paths.begin(), app_icon_paths.end());
 		icon_texture_cache = decltype(icon_texture_cache)(
 		    std::make_move_iterator(icon_texture_cache.begin()),
 		    std::make_move_iterator(icon_texture_cache.end())
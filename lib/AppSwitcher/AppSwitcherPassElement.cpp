@@ -17,22 +17,10 @@ bool AppSwitcherPassElement::needsPrecomputeBlur() { return false; }
 
 std::optional<CBox> AppSwitcherPassElement::boundingBox()
 {
-	auto box = instance->get_container_box();
-	if (!box.has_value())
+	const auto *layout = instance->get_layout();
+	if (!layout) [[unlikely]]
 		return std::nullopt;
-
-	const auto &shadow = instance->shadow;
-	if (shadow.enabled && shadow.range > 0 && shadow.scale > 0.F && shadow.color.a > 0.0) {
-		*box = instance->get_shadow_box(
-		    *box, shadow, g_pHyprRenderer->m_renderData.pMonitor->m_scale
-		);
-	} else {
-		box->expand(
-		    instance->container_border_width * g_pHyprRenderer->m_renderData.pMonitor->m_scale
-		);
-	}
-
-	return box->scale(1.F / g_pHyprRenderer->m_renderData.pMonitor->m_scale).round();
+	return layout->outer_box.copy().scale(1.F / layout->monitor_scale).round();
 }
 
 CRegion AppSwitcherPassElement::opaqueRegion() { return {}; }
@@ -0,0 +1,578 @@
+module;
+
+#include <GLES3/gl32.h>
+
+module wm.AppSwitcher;
+
+import std;
+
+import wm.AppInfoLoader;
+import wm.Support.Logging;
+import wm.Support.ShelfPacker;
+
+using namespace wm;
+
+using std::size_t, std::uint8_t;
+
+// transparent border around each icon, keeps linear filtering from blending
+// in the neighbouring icons
+static constexpr uint32_t gutter = 1;
+
+// premultiplied white at a quarter opacity
+static constexpr std::array<uint8_t, 4> placeholder_color = {64, 64, 64, 64};
+
+static constexpr const char *vertex_source = R"(#version 300 es
+uniform mat3 proj;
+layout(location = 0) in vec2 pos;
+layout(location = 1) in vec2 texcoord;
+out vec2 v_texcoord;
+
+void main() {
+	gl_Position = vec4((proj * vec3(pos, 1.0)).xy, 0.0, 1.0);
+	v_texcoord  = texcoord;
+}
+)";
+
+static constexpr const char *fragment_source = R"(#version 300 es
+precision highp float;
+uniform sampler2D tex;
+in vec2 v_texcoord;
+out vec4 color;
+
+void main() { color = texture(tex, v_texcoord); }
+)";
+
+/// Copies `image` into a region of the atlas's pixels.
+static void copy_pixels(const Image &image, uint8_t *dst, size_t dst_stride)
+{
+	auto src_stride = size_t{image.width} * 4;
+	for (uint32_t y = 0; y < image.height; y++)
+		std::memcpy(dst + y * dst_stride, image.buffer.get() + y * src_stride, src_stride);
+}
+
+static GLuint compile_shader(GLenum type, const char *source)
+{
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, nullptr);
+	glCompileShader(shader);
+
+	GLint ok = GL_FALSE;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+	if (!ok) [[unlikely]] {
+		log<LogLevel::ERR, "IconAtlas: failed to compile shader">();
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+IconAtlas::IconAtlas() :
+    packer(initial_size, initial_size),
+    pixels(size_t{initial_size} * initial_size * 4),
+    next_id(0),
+    generation(0),
+    texture(0),
+    texture_size(0),
+    pbo(0),
+    program(0),
+    proj_location(-1),
+    tex_location(-1),
+    vao(0),
+    vbo(0)
+{
+	// a single texel, sampled at its center so that it covers a whole quad
+	auto rect = packer.insert(1 + 2 * gutter, 1 + 2 * gutter).value();
+	std::memcpy(
+	    pixels.data() + ((size_t{rect.y} + gutter) * initial_size + rect.x + gutter) * 4,
+	    placeholder_color.data(),
+	    4
+	);
+	placeholder = add_slot(rect);
+}
+
+IconAtlas::~IconAtlas()
+{
+	if (texture)
+		glDeleteTextures(1, &texture);
+	if (pbo)
+		glDeleteBuffers(1, &pbo);
+	if (program) {
+		glDeleteProgram(program);
+		glDeleteVertexArrays(1, &vao);
+		glDeleteBuffers(1, &vbo);
+	}
+}
+
+AtlasSlot IconAtlas::add_slot(const PackedRect &rect)
+{
+	AtlasSlot slot{.id = next_id++};
+	slots.emplace(slot.id, Slot{.rect = rect, .texture_x = 0, .texture_y = 0, .uploaded = false});
+	return slot;
+}
+
+std::optional<AtlasSlot> IconAtlas::add(const Image &image)
+{
+	// the loader normalizes every icon, so uploads need no conversion
+	if (!image.buffer || image.format != ImageFormat::PremultipliedRGBA) [[unlikely]]
+		return std::nullopt;
+
+	auto width  = image.width + 2 * gutter;
+	auto height = image.height + 2 * gutter;
+	auto rect   = packer.insert(width, height);
+	if (!rect) {
+		// compact when at most half of the atlas would be live, grow otherwise
+		auto size   = packer.width();
+		auto needed = packer.live_area() + uint64_t{width} * height;
+		if (needed * 2 > uint64_t{size} * size)
+			size *= 2;
+		for (; !rect && size <= max_size; size *= 2)
+			rect = repack(size, width, height);
+		if (!rect) [[unlikely]] {
+			log<LogLevel::WARN, "IconAtlas: no room for a {}x{} icon">(image.width, image.height);
+			return std::nullopt;
+		}
+	}
+
+	auto stride = size_t{packer.width()} * 4;
+	copy_pixels(
+	    image, pixels.data() + (rect->y + gutter) * stride + size_t{rect->x + gutter} * 4, stride
+	);
+	return add_slot(*rect);
+}
+
+void IconAtlas::remove(AtlasSlot slot)
+{
+	auto it = slots.find(slot.id);
+	if (it == slots.end()) [[unlikely]]
+		return;
+	// the space is reclaimed by the next repack
+	packer.remove(it->second.rect);
+	slots.erase(it);
+}
+
+bool IconAtlas::has_pending_uploads(std::span<const AtlasQuad> quads) const
+{
+	auto is_pending = [this](AtlasSlot slot) {
+		auto it = slots.find(slot.id);
+		return it != slots.end() && !it->second.uploaded;
+	};
+	return is_pending(placeholder) || std::ranges::any_of(quads, is_pending, &AtlasQuad::slot);
+}
+
+std::optional<PackedRect> IconAtlas::repack(uint32_t size, uint32_t width, uint32_t height)
+{
+	// tallest first keeps the shelves tight
+	std::vector<std::pair<const uint32_t, Slot> *> live;
+	live.reserve(slots.size());
+	for (auto &entry : slots)
+		live.push_back(&entry);
+	std::ranges::sort(live, std::ranges::greater{}, [](const auto *p) {
+		return p->second.rect.height;
+	});
+
+	ShelfPacker             new_packer(size, size);
+	std::vector<PackedRect> new_rects;
+	new_rects.reserve(live.size());
+	for (const auto *entry : live) {
+		auto new_rect = new_packer.insert(entry->second.rect.width, entry->second.rect.height);
+		if (!new_rect)
+			return std::nullopt;
+		new_rects.push_back(*new_rect);
+	}
+	auto rect = new_packer.insert(width, height);
+	if (!rect)
+		return std::nullopt;
+
+	std::vector<uint8_t> new_pixels(size_t{size} * size * 4);
+	auto                 old_stride = size_t{packer.width()} * 4;
+	auto                 new_stride = size_t{size} * 4;
+	for (auto &&[entry, new_rect] : std::views::zip(live, new_rects)) {
+		auto &old_rect = entry->second.rect;
+		for (uint32_t y = 0; y < old_rect.height; y++) {
+			std::memcpy(
+			    new_pixels.data() + (new_rect.y + y) * new_stride + size_t{new_rect.x} * 4,
+			    pixels.data() + (old_rect.y + y) * old_stride + size_t{old_rect.x} * 4,
+			    size_t{old_rect.width} * 4
+			);
+		}
+		// uploaded icons keep their old texture position until the texture
+		// is reallocated and they are copied over
+		old_rect = new_rect;
+	}
+
+	packer       = std::move(new_packer);
+	pixels       = std::move(new_pixels);
+	texture_size = 0;
+	log<LogLevel::DEBUG, "IconAtlas: repacked {} icons into {}x{}">(live.size(), size, size);
+	return rect;
+}
+
+void IconAtlas::reallocate(uint32_t size)
+{
+	GLuint new_texture;
+	glGenTextures(1, &new_texture);
+	glBindTexture(GL_TEXTURE_2D, new_texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, static_cast<GLsizei>(size), size);
+
+	if (texture) {
+		// uploaded icons move on the GPU instead of going through the budget again
+		for (auto &[_, slot] : slots) {
+			if (!slot.uploaded)
+				continue;
+			glCopyImageSubData(
+			    texture,
+			    GL_TEXTURE_2D,
+			    0,
+			    slot.texture_x,
+			    slot.texture_y,
+			    0,
+			    new_texture,
+			    GL_TEXTURE_2D,
+			    0,
+			    slot.rect.x,
+			    slot.rect.y,
+			    0,
+			    slot.rect.width,
+			    slot.rect.height,
+			    1
+			);
+			slot.texture_x = slot.rect.x;
+			slot.texture_y = slot.rect.y;
+		}
+		glDeleteTextures(1, &texture);
+	}
+	texture      = new_texture;
+	texture_size = size;
+	// every icon's texture coordinates changed
+	generation++;
+}
+
+void IconAtlas::upload(std::span<const AtlasQuad> quads)
+{
+	auto size = packer.width();
+	if (texture_size != size)
+		reallocate(size);
+	else
+		glBindTexture(GL_TEXTURE_2D, texture);
+
+	// only icons on screen are uploaded, so the work is bounded by the quads
+	// however many icons wait off screen; at least one per frame, however large
+	size_t bytes = 0;
+	upload_batch.clear();
+	auto select = [&](AtlasSlot slot) {
+		auto it = slots.find(slot.id);
+		if (it == slots.end() || it->second.uploaded)
+			return true;
+		auto *entry = &it->second;
+		if (std::ranges::contains(upload_batch, entry, &std::pair<Slot *, size_t>::first))
+			return true;
+		auto rect_bytes = size_t{entry->rect.width} * entry->rect.height * 4;
+		if (bytes && bytes + rect_bytes > upload_budget_bytes)
+			return false;
+		upload_batch.emplace_back(entry, bytes);
+		bytes += rect_bytes;
+		return true;
+	};
+	if (select(placeholder)) {
+		for (const auto &quad : quads) {
+			if (!select(quad.slot))
+				break;
+		}
+	}
+	if (upload_batch.empty())
+		return;
+
+	if (!pbo)
+		glGenBuffers(1, &pbo);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+	// orphaning leaves the storage the last frame's uploads read from alone
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(bytes), nullptr, GL_STREAM_DRAW);
+	auto *mapped = static_cast<uint8_t *>(glMapBufferRange(
+	    GL_PIXEL_UNPACK_BUFFER,
+	    0,
+	    static_cast<GLsizeiptr>(bytes),
+	    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT
+	));
+	if (!mapped) [[unlikely]] {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	auto it    = upload_batch.begin();
+	for (; it != upload_batch.end(); ++it) {
+		auto [slot, offset] = *it;
+		if (offset && std::chrono::steady_clock::now() - start > upload_budget)
+			break;
+
+		const auto &rect      = slot->rect;
+		auto        row_bytes = size_t{rect.width} * 4;
+		for (uint32_t y = 0; y < rect.height; y++) {
+			std::memcpy(
+			    mapped + offset + y * row_bytes,
+			    pixels.data() + ((size_t{rect.y} + y) * size + rect.x) * 4,
+			    row_bytes
+			);
+		}
+	}
+	upload_batch.erase(it, upload_batch.end());
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	generation++;
+
+	for (auto [slot, slot_offset] : upload_batch) {
+		glTexSubImage2D(
+		    GL_TEXTURE_2D,
+		    0,
+		    slot->rect.x,
+		    slot->rect.y,
+		    slot->rect.width,
+		    slot->rect.height,
+		    GL_RGBA,
+		    GL_UNSIGNED_BYTE,
+		    reinterpret_cast<const void *>(slot_offset)
+		);
+		slot->texture_x = slot->rect.x;
+		slot->texture_y = slot->rect.y;
+		slot->uploaded  = true;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+bool IconAtlas::init_program()
+{
+	if (program)
+		return true;
+
+	GLuint vertex   = compile_shader(GL_VERTEX_SHADER, vertex_source);
+	GLuint fragment = compile_shader(GL_FRAGMENT_SHADER, fragment_source);
+	if (!vertex || !fragment) [[unlikely]] {
+		glDeleteShader(vertex);
+		glDeleteShader(fragment);
+		return false;
+	}
+
+	GLuint linked = glCreateProgram();
+	glAttachShader(linked, vertex);
+	glAttachShader(linked, fragment);
+	glLinkProgram(linked);
+	glDeleteShader(vertex);
+	glDeleteShader(fragment);
+
+	GLint ok = GL_FALSE;
+	glGetProgramiv(linked, GL_LINK_STATUS, &ok);
+	if (!ok) [[unlikely]] {
+		log<LogLevel::ERR, "IconAtlas: failed to link program">();
+		glDeleteProgram(linked);
+		return false;
+	}
+
+	program       = linked;
+	proj_location = glGetUniformLocation(program, "proj");
+	tex_location  = glGetUniformLocation(program, "tex");
+
+	glGenVertexArrays(1, &vao);
+	glGenBuffers(1, &vbo);
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), nullptr);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(
+	    1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), reinterpret_cast<void *>(2 * sizeof(float))
+	);
+	return true;
+}
+
+IconLayer::~IconLayer()
+{
+	if (framebuffer)
+		glDeleteFramebuffers(1, &framebuffer);
+	if (texture)
+		glDeleteTextures(1, &texture);
+}
+
+bool IconLayer::is_current(
+    const CBox &new_box, std::span<const AtlasQuad> new_quads, uint64_t generation
+) const
+{
+	auto same_quad = [](const AtlasQuad &a, const AtlasQuad &b) {
+		return a.slot.id == b.slot.id && a.box.x == b.box.x && a.box.y == b.box.y
+		    && a.box.w == b.box.w && a.box.h == b.box.h;
+	};
+	return texture && atlas_generation == generation && box.x == new_box.x && box.y == new_box.y
+	    && box.w == new_box.w && box.h == new_box.h
+	    && std::ranges::equal(quads, new_quads, same_quad);
+}
+
+void IconAtlas::append_quad(const CBox &box, std::array<float, 4> uv, Vector2D origin)
+{
+	auto [u0, v0, u1, v1] = uv;
+	auto x0               = static_cast<float>(box.x - origin.x);
+	auto y0               = static_cast<float>(box.y - origin.y);
+	auto x1               = static_cast<float>(box.x + box.w - origin.x);
+	auto y1               = static_cast<float>(box.y + box.h - origin.y);
+	vertices.insert(
+	    vertices.end(),
+	    {
+	        x0, y0, u0, v0, x1, y0, u1, v0, x0, y1, u0, v1,
+	        x0, y1, u0, v1, x1, y0, u1, v0, x1, y1, u1, v1,
+	    }
+	);
+}
+
+void IconAtlas::flush(uint32_t source, const Mat3x3 &projection)
+{
+	glBindTexture(GL_TEXTURE_2D, source);
+	glUniformMatrix3fv(proj_location, 1, GL_TRUE, projection.getMatrix().data());
+	glBufferData(
+	    GL_ARRAY_BUFFER,
+	    static_cast<GLsizeiptr>(vertices.size() * sizeof(float)),
+	    vertices.data(),
+	    GL_STREAM_DRAW
+	);
+	if (!vertices.empty()) [[likely]]
+		glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(vertices.size() / 4));
+	vertices.clear();
+}
+
+void IconAtlas::render_layer(IconLayer &layer, const CBox &box, std::span<const AtlasQuad> quads)
+{
+	auto width  = static_cast<uint32_t>(box.w);
+	auto height = static_cast<uint32_t>(box.h);
+	if (!layer.texture || layer.width != width || layer.height != height) {
+		if (layer.texture)
+			glDeleteTextures(1, &layer.texture);
+		glGenTextures(1, &layer.texture);
+		glBindTexture(GL_TEXTURE_2D, layer.texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexStorage2D(
+		    GL_TEXTURE_2D, 1, GL_RGBA8, static_cast<GLsizei>(width), static_cast<GLsizei>(height)
+		);
+		if (!layer.framebuffer)
+			glGenFramebuffers(1, &layer.framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, layer.framebuffer);
+		glFramebufferTexture2D(
+		    GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, layer.texture, 0
+		);
+		layer.width  = width;
+		layer.height = height;
+	} else {
+		glBindFramebuffer(GL_FRAMEBUFFER, layer.framebuffer);
+	}
+
+	glViewport(0, 0, static_cast<GLsizei>(width), static_cast<GLsizei>(height));
+	glClearColor(0.F, 0.F, 0.F, 0.F);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	// row 0 of the layer is its top, like the atlas's
+	auto sx = 2.F / static_cast<float>(width);
+	auto sy = 2.F / static_cast<float>(height);
+	for (const auto &[quad_box, slot] : quads) {
+		auto uv = get_uv(slot);
+		if (!uv)
+			uv = get_uv(placeholder);
+		if (uv) [[likely]]
+			append_quad(quad_box, *uv, {box.x, box.y});
+	}
+	flush(texture, Mat3x3(std::array<float, 9>{sx, 0, -1, 0, sy, -1, 0, 0, 1}));
+
+	layer.box = box;
+	layer.quads.assign(quads.begin(), quads.end());
+	layer.atlas_generation = generation;
+}
+
+std::optional<std::array<float, 4>> IconAtlas::get_uv(AtlasSlot slot) const
+{
+	auto it = slots.find(slot.id);
+	if (it == slots.end() || !it->second.uploaded) [[unlikely]]
+		return std::nullopt;
+	auto        size = static_cast<float>(texture_size);
+	const auto &rect = it->second.rect;
+	if (slot.id == placeholder.id) {
+		auto u = (static_cast<float>(rect.x + gutter) + 0.5F) / size;
+		auto v = (static_cast<float>(rect.y + gutter) + 0.5F) / size;
+		return std::array{u, v, u, v};
+	}
+	return std::array{
+	    static_cast<float>(rect.x + gutter) / size,
+	    static_cast<float>(rect.y + gutter) / size,
+	    static_cast<float>(rect.x + rect.width - gutter) / size,
+	    static_cast<float>(rect.y + rect.height - gutter) / size,
+	};
+}
+
+void IconAtlas::draw(
+    IconLayer &layer, std::span<const AtlasQuad> quads, const CBox &box, const Mat3x3 &projection
+)
+{
+	if (quads.empty())
+		return;
+
+	// Hyprland caches some of this state, so it must be left as it was found
+	GLint   prev_program, prev_vao, prev_buffer, prev_unpack_buffer;
+	GLint   prev_texture, prev_active_texture, prev_draw_framebuffer, prev_read_framebuffer;
+	GLint   prev_viewport[4];
+	GLfloat prev_clear_color[4];
+	glGetIntegerv(GL_CURRENT_PROGRAM, &prev_program);
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &prev_vao);
+	glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &prev_buffer);
+	glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &prev_unpack_buffer);
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prev_draw_framebuffer);
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &prev_read_framebuffer);
+	glGetIntegerv(GL_VIEWPORT, prev_viewport);
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, prev_clear_color);
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &prev_active_texture);
+	glActiveTexture(GL_TEXTURE0);
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &prev_texture);
+	GLboolean prev_blend   = glIsEnabled(GL_BLEND);
+	GLboolean prev_scissor = glIsEnabled(GL_SCISSOR_TEST);
+
+	if (init_program()) [[likely]] {
+		upload(quads);
+
+		glUseProgram(program);
+		glUniform1i(tex_location, 0);
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+		// whole pixels, so that the layer maps onto the monitor texel for texel
+		CBox layer_box;
+		layer_box.x = std::floor(box.x);
+		layer_box.y = std::floor(box.y);
+		layer_box.w = std::ceil(box.x + box.w) - layer_box.x;
+		layer_box.h = std::ceil(box.y + box.h) - layer_box.y;
+		if (!layer.is_current(layer_box, quads, generation)) {
+			glDisable(GL_SCISSOR_TEST);
+			render_layer(layer, layer_box, quads);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, prev_draw_framebuffer);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, prev_read_framebuffer);
+			glViewport(prev_viewport[0], prev_viewport[1], prev_viewport[2], prev_viewport[3]);
+			glClearColor(
+			    prev_clear_color[0], prev_clear_color[1], prev_clear_color[2], prev_clear_color[3]
+			);
+			if (prev_scissor)
+				glEnable(GL_SCISSOR_TEST);
+		}
+
+		append_quad(layer_box, {0.F, 0.F, 1.F, 1.F});
+		flush(layer.texture, projection);
+	}
+
+	if (!prev_blend)
+		glDisable(GL_BLEND);
+	glBindTexture(GL_TEXTURE_2D, prev_texture);
+	glActiveTexture(prev_active_texture);
+	glBindBuffer(GL_ARRAY_BUFFER, prev_buffer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, prev_unpack_buffer);
+	glBindVertexArray(prev_vao);
+	glUseProgram(prev_program);
+}
@@ -0,0 +1,44 @@
+module wm.AppSwitcher;
+
+import std;
+import hyprland.render;
+import hyprutils.math;
+
+using namespace wm;
+
+IconStripPassElement::IconStripPassElement(
+    IconAtlas *atlas, IconLayer *layer, std::vector<AtlasQuad> quads, const CBox &box
+) :
+    atlas(atlas),
+    layer(layer),
+    quads(std::move(quads)),
+    box(box)
+{}
+
+std::vector<CUniquePointer<IPassElement>> IconStripPassElement::draw()
+{
+	auto monitor = g_pHyprRenderer->m_renderData.pMonitor;
+	if (!monitor) [[unlikely]]
+		return {};
+
+	// what Hyprland uses for untransformed textures, without the per-box
+	// scaling since the vertices are already in monitor pixels
+	auto projection =
+	    Mat3x3::outputProjection(monitor->m_pixelSize, Hyprutils::Math::HYPRUTILS_TRANSFORM_NORMAL)
+	        .multiply(monitor->m_projMatrix);
+	atlas->draw(*layer, quads, box, projection);
+	return {};
+}
+
+bool IconStripPassElement::needsLiveBlur() { return false; }
+
+bool IconStripPassElement::needsPrecomputeBlur() { return false; }
+
+std::optional<CBox> IconStripPassElement::boundingBox()
+{
+	if (quads.empty()) [[unlikely]]
+		return std::nullopt;
+	return box.copy().scale(1.F / g_pHyprRenderer->m_renderData.pMonitor->m_scale).round();
+}
+
+CRegion IconStripPassElement::opaqueRegion() { return {}; }
@@ -0,0 +1,53 @@
+module wm.Support.ShelfPacker;
+
+import std;
+
+namespace wm {
+
+ShelfPacker::ShelfPacker(uint32_t width, uint32_t height) :
+    area_width(width),
+    area_height(height),
+    used_area(0)
+{}
+
+std::optional<PackedRect> ShelfPacker::insert(uint32_t width, uint32_t height)
+{
+	if (width == 0 || height == 0 || width > area_width) [[unlikely]]
+		return std::nullopt;
+
+	// the lowest shelf that fits without wasting more than a quarter of it
+	Shelf *best = nullptr;
+	for (auto &shelf : shelves) {
+		if (shelf.height < height || uint64_t{height} * 4 < uint64_t{shelf.height} * 3
+		    || area_width - shelf.used_width < width) {
+			continue;
+		}
+		if (!best || shelf.height < best->height)
+			best = &shelf;
+	}
+
+	if (!best) {
+		uint32_t y = shelves.empty() ? 0 : shelves.back().y + shelves.back().height;
+		if (area_height - y < height)
+			return std::nullopt;
+		best = &shelves.emplace_back(Shelf{.y = y, .height = height, .used_width = 0});
+	}
+
+	PackedRect rect{.x = best->used_width, .y = best->y, .width = width, .height = height};
+	best->used_width += width;
+	used_area        += uint64_t{width} * height;
+	return rect;
+}
+
+void ShelfPacker::remove(const PackedRect &rect)
+{ used_area -= uint64_t{rect.width} * rect.height; }
+
+void ShelfPacker::reset(uint32_t width, uint32_t height)
+{
+	shelves.clear();
+	area_width  = width;
+	area_height = height;
+	used_area   = 0;
+}
+
+} // namespace wm
@@ -2,6 +2,7 @@ module;
 
 #include <cassert>
 #include <linux/input-event-codes.h>
+#include <wayland-server-core.h>
 
 module wm.WindowManager;
 
@@ -40,26 +41,8 @@ WindowManager::resolve_app_id(std::string_view hl_class)
 	if (app_switcher.dirty) [[unlikely]] {
 		// this code path is unlikely to ever run since scanning desktop files is very fast,
 		// unless the plugin was loaded with windows already open
-		absl::flat_hash_map<const char *, AppStuff> new_stuff_map;
-		new_stuff_map.reserve(app_id_to_stuff_map.capacity());
-		for (auto &app_id : app_id_focus_history) {
-			auto [app_id_new, name] = app_switcher.app_info_loader.get_app_info(app_id);
-			if (app_id_new) [[likely]] {
-				auto [it, _] = new_stuff_map.emplace(
-				    app_id_new, std::move(app_id_to_stuff_map.find(app_id)->second)
-				);
-				it->second.icon_texture = app_switcher.load_app_icon(app_id_new);
-				app_id_pool.remove(app_id);
-				app_id = app_id_new;
-			} else {
-				auto [it, _] = new_stuff_map.emplace(
-				    app_id, std::move(app_id_to_stuff_map.find(app_id)->second)
-				);
-				it->second.icon_texture = std::monostate{};
-			}
-		}
-		app_id_to_stuff_map = std::move(new_stuff_map);
-		app_switcher.dirty  = false;
+		refresh_app_entries();
+		app_switcher.dirty = false;
 	}
 	auto [app_id, name]                   = app_switcher.app_info_loader.get_app_info(hl_class);
 	DesktopFileStatus desktop_file_status = DesktopFileStatus::HasDesktopFile;
@@ -70,6 +53,118 @@ WindowManager::resolve_app_id(std::string_view hl_class)
 	return {app_id, name, desktop_file_status};
 }
 
+void WindowManager::refresh_app_entries()
+{
+	absl::flat_hash_map<const char *, AppStuff> new_stuff_map;
+	new_stuff_map.reserve(app_id_to_stuff_map.capacity());
+	// two old app IDs may now resolve to the same app, whose windows are then
+	// merged in focus order
+	auto move_stuff = [&](const char *old_app_id, const char *new_app_id) -> AppStuff & {
+		auto &old_stuff     = app_id_to_stuff_map.find(old_app_id)->second;
+		auto [it, inserted] = new_stuff_map.try_emplace(new_app_id);
+		if (inserted)
+			it->second = std::move(old_stuff);
+		else
+			it->second.windows.append(old_stuff.windows.begin(), old_stuff.windows.end());
+		return it->second;
+	};
+	for (auto [i, app_id] : app_id_focus_history | std::views::enumerate) {
+		auto [app_id_new, name] = app_switcher.app_info_loader.get_app_info(app_id);
+		if (app_id_new) [[likely]] {
+			auto &stuff        = move_stuff(app_id, app_id_new);
+			stuff.app_name     = name;
+			stuff.icon_texture = app_switcher.load_app_icon(app_id_new, static_cast<uint32_t>(i));
+			if (app_id_new != app_id)
+				app_id_pool.remove(app_id); // no-op if `app_id` came from the loader
+			app_id = app_id_new;
+		} else {
+			// the desktop file may have been deleted, in which case `app_id`
+			// is not in the pool yet
+			auto  pooled_app_id = app_id_pool.get(app_id).first;
+			auto &stuff         = move_stuff(app_id, pooled_app_id);
+			stuff.app_name      = std::string_view{};
+			stuff.icon_texture  = std::monostate{};
+			app_id              = pooled_app_id;
+		}
+	}
+	app_id_to_stuff_map = std::move(new_stuff_map);
+
+	// keeps the first, most recently focused occurrence of merged apps
+	absl::flat_hash_set<const char *> seen;
+	seen.reserve(app_id_focus_history.size());
+	std::erase_if(app_id_focus_history, [&](const char *app_id) {
+		return !seen.insert(app_id).second;
+	});
+}
+
+void WindowManager::on_desktop_files_changed()
+{
+	if (!app_switcher.app_info_loader.process_watch_events())
+		return;
+	// entries get re-resolved when the scan result is used for the first time
+	if (app_switcher.dirty)
+		return;
+
+	// both hold pointers into `app_id_to_stuff_map`
+	if (window_switcher.is_active()) [[unlikely]]
+		window_switcher.deactivate();
+	if (app_switcher.is_active()) [[unlikely]]
+		app_switcher.deactivate();
+
+	refresh_app_entries();
+	prefetch_icons();
+}
+
+void WindowManager::on_scan_finished()
+{
+	wl_event_source_remove(scan_finished_watch);
+	scan_finished_watch = nullptr;
+	if (!app_switcher.app_info_loader.is_available()) [[unlikely]]
+		return;
+
+	// Otherwise the windows restored at startup are resolved, and their icons
+	// requested, only once one of them is touched.
+	if (app_switcher.dirty) {
+		// both hold pointers into `app_id_to_stuff_map`
+		if (window_switcher.is_active()) [[unlikely]]
+			window_switcher.deactivate();
+		if (app_switcher.is_active()) [[unlikely]]
+			app_switcher.deactivate();
+
+		// icons are requested in order of recency
+		refresh_app_entries();
+		app_switcher.dirty = false;
+	}
+	prefetch_icons();
+}
+
+void WindowManager::prefetch_icons()
+{
+	auto &loader = app_switcher.app_info_loader;
+	if (!loader.is_available())
+		return;
+
+	std::vector<const char *> app_ids;
+	app_ids.reserve(prefetch_classes.size());
+	for (const auto &hl_class : prefetch_classes) {
+		if (auto [app_id, _] = loader.get_app_info(hl_class); app_id)
+			app_ids.push_back(app_id);
+	}
+	app_switcher.prefetch_app_icons(app_ids);
+}
+
+void WindowManager::prefetch_app(std::string_view hl_class)
+{
+	if (hl_class.empty() || std::ranges::contains(next_prefetch_classes, hl_class))
+		return;
+	next_prefetch_classes.emplace_back(hl_class);
+	if (std::ranges::contains(prefetch_classes, hl_class))
+		return;
+	prefetch_classes.emplace_back(hl_class);
+	// before the scan finishes, `on_scan_finished` does it
+	prefetch_icons();
+}
+
 AppEntryResult WindowManager::get_or_create_app_entry(std::string_view hl_class)
 {
 	auto [app_id, name, desktop_file_status] = resolve_app_id(hl_class);
@@ -83,7 +178,8 @@ AppEntryResult WindowManager::get_or_create_app_entry(std::string_view hl_class)
 		app_id_focus_history.push_back(app_id);
 		switch (desktop_file_status) {
 		case DesktopFileStatus::HasDesktopFile:
-			it->second.icon_texture = app_switcher.load_app_icon(app_id);
+			// a new window is usually focused right away
+			it->second.icon_texture = app_switcher.load_app_icon(app_id, 0);
 			break;
 		case DesktopFileStatus::NoDesktopFile: it->second.icon_texture = {}; break;
 		case DesktopFileStatus::Scanning:      break;
@@ -93,8 +189,52 @@ AppEntryResult WindowManager::get_or_create_app_entry(std::string_view hl_class)
 	return res;
 }
 
-WindowManager::WindowManager(const WindowManagerConfig &config) : app_switcher(config.app_switcher)
+WindowManager::WindowManager(const WindowManagerConfig &config) :
+    app_switcher(config.app_switcher),
+    desktop_file_watch(nullptr),
+    icon_ready_watch(nullptr),
+    scan_finished_watch(nullptr)
 {
+	if (int fd = app_switcher.app_info_loader.watch_fd(); fd != -1) [[likely]] {
+		desktop_file_watch = wl_event_loop_add_fd(
+		    g_pCompositor->m_wlEventLoop,
+		    fd,
+		    WL_EVENT_READABLE,
+		    [](int, uint32_t, void *data) {
+			    static_cast<WindowManager *>(data)->on_desktop_files_changed();
+			    return 0;
+		    },
+		    this
+		);
+	}
+	if (int fd = app_switcher.app_info_loader.ready_icons_fd(); fd != -1) [[likely]] {
+		icon_ready_watch = wl_event_loop_add_fd(
+		    g_pCompositor->m_wlEventLoop,
+		    fd,
+		    WL_EVENT_READABLE,
+		    [](int, uint32_t, void *data) {
+			    auto *self = static_cast<WindowManager *>(data);
+			    self->app_switcher.on_icons_ready(
+			        self->app_id_focus_history, self->app_id_to_stuff_map
+			    );
+			    return 0;
+		    },
+		    this
+		);
+	}
+	if (int fd = app_switcher.app_info_loader.scan_finished_fd(); fd != -1) [[likely]] {
+		scan_finished_watch = wl_event_loop_add_fd(
+		    g_pCompositor->m_wlEventLoop,
+		    fd,
+		    WL_EVENT_READABLE,
+		    [](int, uint32_t, void *data) {
+			    static_cast<WindowManager *>(data)->on_scan_finished();
+			    return 0;
+		    },
+		    this
+		);
+	}
+
 	window_info_map.reserve(10);
 	app_id_to_stuff_map.reserve(20);
 	for (const auto &window :
@@ -104,6 +244,16 @@ WindowManager::WindowManager(const WindowManagerConfig &config) : app_switcher(c
 	}
 }
 
+WindowManager::~WindowManager()
+{
+	if (desktop_file_watch)
+		wl_event_source_remove(desktop_file_watch);
+	if (icon_ready_watch)
+		wl_event_source_remove(icon_ready_watch);
+	if (scan_finished_watch)
+		wl_event_source_remove(scan_finished_watch);
+}
+
 void WindowManager::reset_config()
 {
 	if (app_switcher.is_active()) [[unlikely]]
@@ -112,6 +262,11 @@ void WindowManager::reset_config()
 		window_switcher.deactivate();
 
 	app_switcher.reset_config();
+
+	// The reloaded Lua config has reported its classes by now; those it no
+	// longer mentions are dropped.
+	prefetch_classes = std::exchange(next_prefetch_classes, {});
+	prefetch_icons();
 }
 
 void WindowManager::on_open_window(const PHLWINDOW &window)
@@ -0,0 +1,54 @@
+export module wm.AppInfoLoader.AppIdIndex;
+
+import std;
+
+using std::size_t, std::uint32_t, std::uint64_t;
+
+export namespace wm {
+
+/// An immutable map from app IDs to 32-bit values, built on a minimal perfect
+/// hash in the style of PTHash: keys are split into small buckets, and each
+/// bucket gets a pilot that sends all of its keys to distinct free slots. A
+/// lookup is one hash, a pilot and a slot read, and a length and prefix check
+/// before the rest of the key is compared.
+///
+/// Keys are not copied and have to outlive the index. Nothing is modified
+/// after construction, so any number of threads may read it.
+class AppIdIndex {
+	struct Slot {
+		/// first 8 bytes of the key, zero-padded
+		uint64_t    prefix;
+		uint32_t    length;
+		uint32_t    value;
+		const char *key;
+	};
+
+	std::vector<uint32_t> pilots;
+	std::vector<Slot>     slots;
+	uint64_t              seed = 0;
+
+public:
+	AppIdIndex() = default;
+
+	/// Keys have to be distinct and null-terminated. `seed` is where the
+	/// search for a working hash seed starts.
+	explicit AppIdIndex(
+	    std::span<const std::pair<std::string_view, uint32_t>> entries, uint64_t seed = 0
+	);
+
+	/// The stored key and its value, {nullptr, 0} if `key` is not in the index.
+	[[nodiscard]] std::pair<const char *, uint32_t> find(std::string_view key) const;
+
+	[[nodiscard]] size_t size() const { return slots.size(); }
+
+private:
+	[[nodiscard]] uint64_t hash(std::string_view key) const;
+
+	[[nodiscard]] size_t bucket(uint64_t h) const;
+
+	[[nodiscard]] size_t position(uint64_t h, uint32_t pilot) const;
+
+	bool build(std::span<const std::pair<std::string_view, uint32_t>> entries);
+};
+
+} // namespace wm
@@ -9,20 +9,83 @@ import absl;
 import llvm.Support;
 
 export import wm.AppInfoLoader.Image;
+import wm.AppInfoLoader.AppIdIndex;
+import wm.AppInfoLoader.IconTheme;
+import wm.AppInfoLoader.ImageCache;
+import wm.AppInfoLoader.IndexCache;
 import wm.AppInfoLoader.Xdg;
 
-using std::size_t, std::uint16_t, std::uint64_t;
+using std::size_t, std::int64_t, std::uint16_t, std::uint32_t, std::uint64_t;
 
-struct XdgInfo {
-	std::string_view                      name;
-	const char                           *icon_path;
-	const char                           *desktop_file_path;
-	std::chrono::system_clock::time_point desktop_file_last_access;
+/// Desktop files that won precedence, one record each, as parallel arrays
+/// indexed by a 32-bit record index. Both the desktop file ID and the
+/// StartupWMClass of a record map to it in `AppInfoLoader::app_id_to_record`.
+///
+/// Names and iconstrings point at the entry's strings, which the loader's
+/// string savers or the index cache mapping keep alive as long as the
+/// loader, so views into them stay valid when app info changes.
+struct AppRecords {
+	std::vector<const char *> names;
+	std::vector<uint32_t>     name_lengths;
+	/// null if the desktop file has no icon
+	std::vector<const char *> iconstrings;
+	/// identifies the desktop file when its aliases are removed
+	std::vector<const char *> desktop_file_paths;
+	/// valid if `icon_resolved`
+	std::vector<const char *> icon_paths;
+	std::vector<bool>         icon_resolved;
+	/// records whose aliases were removed, reused before the arrays grow
+	std::vector<uint32_t>     free_records;
+
+	[[nodiscard]] uint32_t add(const DesktopEntry &entry);
+
+	void remove(uint32_t record);
+
+	[[nodiscard]] std::string_view name(uint32_t record) const
+	{ return {names[record], name_lengths[record]}; }
+
+	[[nodiscard]] const char *iconstring(uint32_t record) const { return iconstrings[record]; }
 };
 
 struct Task {
-	const char             *icon_path;
-	std::promise<wm::Image> promise;
+	/// interned, one task per path
+	const char                    *icon_path;
+	/// lower first
+	uint32_t                       priority;
+	/// FIFO among equal priorities
+	uint64_t                       seq;
+	uint16_t                       icon_size;
+	std::promise<wm::Image>        promise;
+	/// handed to every request for `icon_path` until the decode finishes
+	std::shared_future<wm::Image> future;
+};
+
+/// Where an indexed directory sits in the XDG precedence order.
+struct DirInfo {
+	/// index into `XdgAppDirs::dirs`; lower wins
+	uint32_t         app_dir;
+	/// 0 for app dirs
+	uint32_t         depth;
+	/// prepended to desktop file names to form their IDs, e.g. "kde4-"
+	std::string_view id_prefix;
+	/// inotify watch descriptor, -1 if not watched
+	int              wd;
+};
+
+/// Where an entry sits in `AppInfoLoader::dir_indices`.
+struct EntryRef {
+	uint32_t dir_idx;
+	uint32_t entry_idx;
+};
+
+/// Desktop file IDs to the entries that have them, in no particular order.
+/// Usually only one.
+using EntryRefs = absl::flat_hash_map<std::string_view, llvm::SmallVector<EntryRef, 1>>;
+
+struct WatchEvent {
+	int         wd;
+	uint32_t    mask;
+	std::string name;
 };
 
 export namespace wm {
@@ -37,21 +100,89 @@ struct AppInfo {
 	std::string_view name;
 };
 
-// TODO: watch app_dirs.
 class AppInfoLoader {
-	llvm::BumpPtrAllocator                         string_alloc;
-	llvm::StringSaver                              string_saver;
-	absl::flat_hash_map<std::string_view, XdgInfo> app_id_to_info_map;
-	std::vector<const gchar *>                     icon_themes;
-	NkXdgThemeContext                             *theme_context;
-	mutable std::queue<Task>                       task_queue;
-	mutable std::mutex                             mtx;
-	mutable std::condition_variable                cv;
-	std::thread                                    worker;
-	uint16_t                                       icon_size;
-	std::atomic<bool>                              scan_finished_flag;
-	bool                                           worker_processing_tasks;
-	bool                                           shutdown_flag;
+	llvm::BumpPtrAllocator                          string_alloc;
+	llvm::StringSaver                               string_saver;
+	/// Strings saved by the scan threads.
+	std::vector<llvm::BumpPtrAllocator>             scan_allocs;
+	XdgAppDirs                                      app_dirs;
+	IndexCache                                      index_cache;
+	/// Entries of each app dir and subdirectory, including those shadowed by
+	/// earlier dirs.
+	std::vector<DirIndex>                           dir_indices;
+	/// Parallel to `dir_indices`.
+	std::vector<DirInfo>                            dir_infos;
+	/// Indices into `dir_indices` in precedence order.
+	std::vector<uint32_t>                           dir_order;
+	/// Position of each dir in `dir_order`.
+	std::vector<uint32_t>                           dir_ranks;
+	/// Kept in sync with the entries in `dir_indices`, so that finding the
+	/// winner of an ID does not walk every dir.
+	EntryRefs                                       id_to_entries;
+	AppRecords                                      records;
+	/// Desktop file IDs and StartupWMClass values to indices into `records`.
+	absl::flat_hash_map<std::string_view, uint32_t> app_id_to_record;
+	/// Frozen copy of `app_id_to_record` for lookups, rebuilt after the scan
+	/// and after each batch of changes.
+	AppIdIndex                                      app_id_index;
+	/// Guarded by `nk_mtx`, like `icon_size`, once decode threads run.
+	std::vector<const gchar *>                      icon_themes;
+	/// Resolved icon paths, saved once each so that equal paths are equal
+	/// pointers.
+	absl::flat_hash_set<std::string_view>           icon_path_set;
+	/// Taken from `loaded_icon_themes` by the first icon lookup after it is
+	/// set.
+	std::unique_ptr<IconThemes>                     icon_theme_index;
+	/// Used when `icon_theme_index` has no themes or misses. It probes the
+	/// file system, so only decode threads call it, with `nk_mtx` held.
+	NkXdgThemeContext                              *theme_context;
+	std::mutex                                      nk_mtx;
+	/// Iconstrings `icon_theme_index` missed, for the decode threads to ask
+	/// nk about. Guarded by `mtx`.
+	std::vector<const char *>                       fallback_queue;
+	/// nk's answers by iconstring, empty if it has none. Guarded by `mtx`.
+	absl::flat_hash_map<const char *, std::string>  fallback_paths;
+	/// Bumped by `reset_config` so that answers for the old config are
+	/// dropped. Guarded by `mtx`.
+	uint32_t                                        fallback_generation;
+	/// Set when a lookup has to wait, so that the thread answering it
+	/// signals `icon_event_fd`. Guarded by `mtx`.
+	bool                                            icon_lookups_waiting;
+	int                                             inotify_fd;
+	absl::flat_hash_map<int, size_t>                watch_to_dir;
+	/// Watches of the nearest existing ancestors of missing app dirs, to the
+	/// indices of the app dirs waiting on each.
+	absl::flat_hash_map<int, std::vector<size_t>>   ancestor_watches;
+	std::vector<WatchEvent>                         pending_events;
+	ImageCache                                      image_cache;
+	/// eventfd, readable while `ready_icons` is not empty
+	int                                             icon_event_fd;
+	/// eventfd, readable once the scan has finished
+	int                                             scan_event_fd;
+	/// Icon paths whose decodes finished since the last `take_ready_icons`.
+	std::vector<const char *>                       ready_icons;
+	/// Unordered; decode threads take the most urgent task.
+	std::vector<Task>                               task_queue;
+	/// Tasks the decode threads took, until their decodes finish. At most one
+	/// per thread.
+	std::vector<const Task *>                       decoding_tasks;
+	uint64_t                                        next_task_seq;
+	mutable std::mutex                              mtx;
+	mutable std::condition_variable                 cv;
+	/// Scans, then exits.
+	std::thread                                     worker;
+	/// Started once the scan is finished.
+	std::vector<std::thread>                        decode_threads;
+	/// Builds `loaded_icon_themes` after each `reset_config`. It reads theme
+	/// indices and caches, which has no place on the compositor thread.
+	std::future<void>                               icon_theme_loader;
+	/// Guarded by `mtx`.
+	std::unique_ptr<IconThemes>                     loaded_icon_themes;
+	uint16_t                                        icon_size;
+	std::atomic<bool>                               scan_finished_flag;
+	bool                                            worker_processing_tasks;
+	bool                                            shutdown_flag;
+	bool                                            watch_overflowed;
 
 	static const gchar *icon_fallbacks[];
 	static const gchar *sound_fallbacks[];
@@ -65,15 +196,130 @@ public:
 
 	[[nodiscard]] AppInfo get_app_info(std::string_view app_id) const;
 
-	[[nodiscard]] std::optional<std::future<Image>> get_app_icon(std::string_view app_id) const;
+	static constexpr uint32_t lowest_icon_priority = std::numeric_limits<uint32_t>::max();
+
+	/// The app's icon file, resolved against the icon themes on first use.
+	/// Null if the app is unknown or has no icon. Apps with the same icon get
+	/// the same pointer, which stays valid for the loader's lifetime.
+	///
+	/// Nullopt while the themes are still loading or the lookup is left to a
+	/// decode thread. `ready_icons_fd` becomes readable once it can be asked
+	/// again.
+	[[nodiscard]] std::optional<const char *> get_app_icon_path(std::string_view app_id);
+
+	/// Queues a decode of `icon_path`, which has to come from
+	/// `get_app_icon_path`. Icons with lower `priority` are decoded first. A
+	/// decode of the same path that has not finished yet is shared; if it is
+	/// still queued, it keeps the lower of both priorities.
+	[[nodiscard]] std::shared_future<Image>
+	load_icon(const char *icon_path, uint32_t priority = lowest_icon_priority);
+
+	/// Drops the queued decode of `icon_path`, if any, once nobody waits for
+	/// it anymore. Its futures are left with a broken promise.
+	void cancel_icon(const char *icon_path);
+
+	/// `load_icon(get_app_icon_path(app_id), priority)`, nullopt if there is
+	/// no icon path yet.
+	[[nodiscard]] std::optional<std::shared_future<Image>>
+	get_app_icon(std::string_view app_id, uint32_t priority = lowest_icon_priority);
+
+	/// eventfd that becomes readable once per batch of finished decodes, and
+	/// when icon paths that had to wait can be looked up. When it does, call
+	/// `take_ready_icons`. -1 if it could not be created.
+	[[nodiscard]] int ready_icons_fd() const;
+
+	/// Paths of the icons whose futures became ready since the last call, and
+	/// resets `ready_icons_fd`.
+	[[nodiscard]] std::vector<const char *> take_ready_icons();
+
+	/// Gives the pending icon of `app_ids[i]` priority `i`, or the lowest `i`
+	/// of the apps sharing it.
+	void prioritize_icons(std::span<const char *const> app_ids);
 
 	[[nodiscard]] bool is_available();
 
+	/// eventfd that becomes readable once the scan has finished, after which
+	/// `is_available` returns true. -1 if it could not be created.
+	[[nodiscard]] int scan_finished_fd() const;
+
+	/// inotify fd watching the app dirs. When it becomes readable, call
+	/// `process_watch_events`.
+	[[nodiscard]] int watch_fd() const;
+
+	/// Re-reads the desktop files that were created, modified or deleted.
+	/// Returns true if app info changed, in which case app IDs and names
+	/// obtained earlier have to be resolved again.
+	[[nodiscard]] bool process_watch_events();
+
 private:
 	void scan();
 
-	void worker_thread();
+	/// Thread-safe as long as each thread passes its own `saver`.
+	[[nodiscard]] static std::optional<DesktopEntry> read_entry(
+	    llvm::StringSaver &saver,
+	    int                dfd,
+	    std::string_view   dir,
+	    std::string_view   id_prefix,
+	    std::string_view   filename
+	);
+
+	/// `read_entry` for a file that has already been read.
+	[[nodiscard]] static std::optional<DesktopEntry> make_entry(
+	    llvm::StringSaver &saver,
+	    std::string_view   dir,
+	    std::string_view   id_prefix,
+	    std::string_view   filename,
+	    const char        *buffer,
+	    int                size
+	);
+
+	void add_aliases(const DesktopEntry &entry);
+
+	void remove_aliases(const DesktopEntry &entry);
+
+	[[nodiscard]] std::optional<DesktopEntry> find_winner(std::string_view desktop_file_id) const;
+
+	void add_entry(uint32_t dir_idx, const DesktopEntry &entry);
+
+	/// Removes the entry with `desktop_file_id` from `dir_idx`, if any.
+	/// Moves the last entry of the dir into its place.
+	void remove_entry(uint32_t dir_idx, std::string_view desktop_file_id);
+
+	bool apply_pending_changes();
+
+	void freeze_app_ids();
+
+	bool apply_change(size_t dir_idx, std::string_view filename);
+
+	bool resync_dir(size_t dir_idx);
+
+	bool add_subdir(size_t parent_idx, std::string_view name);
+
+	bool remove_dir(size_t dir_idx);
+
+	/// Watches and syncs the app dir `dir_idx`, or the nearest existing
+	/// ancestor if it is missing.
+	bool watch_app_dir(size_t dir_idx);
+
+	/// Calls `watch_app_dir` for the app dirs the scan could not watch.
+	void watch_missing_app_dirs();
+
+	void sort_dir_order();
+
+	void start_decode_threads();
+
+	void decode_thread();
+
+	/// Nullopt until the lookup can be answered, see `get_app_icon_path`.
+	[[nodiscard]] std::optional<const char *> get_icon_path(const char *iconstring);
+
+	/// Asks nk about one queued iconstring. Called by decode threads with
+	/// `lk` holding `mtx`, which is released meanwhile.
+	void resolve_fallback(std::unique_lock<std::mutex> &lk);
+
+	/// Signals `icon_event_fd` if a lookup waits. Called with `mtx` held.
+	void wake_icon_lookups();
 
-	[[nodiscard]] const char *get_icon_path(const char *iconstring);
+	[[nodiscard]] const char *intern_icon_path(std::string_view path);
 };
 } // namespace wm
@@ -0,0 +1,48 @@
+export module wm.AppInfoLoader.BatchReader;
+
+import std;
+import wm.AppInfoLoader.Xdg;
+
+using std::size_t;
+
+export namespace wm {
+
+/// Reads batches of desktop files from one directory with io_uring: the
+/// opens and stats of a batch are submitted together, then the reads and
+/// closes. Falls back to `read_desktop_file` one file at a time when the
+/// build lacks liburing or the kernel refuses to set up a ring (old kernel,
+/// seccomp, `kernel.io_uring_disabled`) or fails while reading; the batch
+/// it failed on is read again that way.
+///
+/// Not thread-safe; each scan thread has its own.
+class BatchReader {
+	struct Ring;
+	std::unique_ptr<Ring> ring;
+
+public:
+	static constexpr size_t max_batch_size = 64;
+
+	BatchReader();
+	BatchReader(const BatchReader &)            = delete;
+	BatchReader &operator=(const BatchReader &) = delete;
+	~BatchReader();
+
+	[[nodiscard]] bool uses_io_uring() const { return ring != nullptr; }
+
+	/// Reads each of `filenames` relative to `dfd`, in the layout returned by
+	/// `read_desktop_file`. A file that cannot be read yields {nullptr, 0}.
+	[[nodiscard]] std::vector<std::pair<unique_aligned_ptr, int>>
+	read(int dfd, std::span<const std::string> filenames);
+
+private:
+	/// False if the ring failed; `files` is left empty then.
+	[[nodiscard]] bool read_batch(
+	    int                                           dfd,
+	    std::span<const std::string>                  filenames,
+	    std::span<std::pair<unique_aligned_ptr, int>> files
+	);
+
+	void drop_ring();
+};
+
+} // namespace wm
@@ -0,0 +1,108 @@
+export module wm.AppInfoLoader.IconTheme;
+
+import std;
+import absl;
+
+using std::size_t, std::uint8_t, std::uint16_t;
+
+enum class IconDirType : uint8_t {
+	Fixed,
+	Scalable,
+	Threshold,
+};
+
+/// One of the directories listed in a theme's index.theme.
+struct IconDir {
+	/// relative to the theme, e.g. "48x48/apps"
+	std::string name;
+	IconDirType type;
+	int         size;
+	int         min_size;
+	int         max_size;
+	int         threshold;
+	int         scale;
+	bool        is_app_context;
+};
+
+/// An icon in one directory of a theme.
+struct IconImage {
+	/// index into `IconTheme::dirs`
+	uint16_t dir;
+	/// which of .png, .svg and .xpm exist, in GTK's `icon_flags` bits
+	uint16_t flags;
+};
+
+/// A theme's icon-theme.cache (as written by gtk-update-icon-cache), mapped
+/// read-only.
+class IconCache {
+	const unsigned char *mapping;
+	size_t               mapping_size;
+
+public:
+	IconCache();
+	IconCache(IconCache &&other) noexcept;
+	IconCache &operator=(IconCache &&other) noexcept;
+	~IconCache();
+
+	/// Maps the cache in `theme_dir` if it is valid and not older than the
+	/// directory, the same staleness check GTK does.
+	[[nodiscard]] static IconCache open(const std::string &theme_dir);
+
+	explicit operator bool() const { return mapping != nullptr; }
+
+	/// Names of the directories the cache covers; `IconImage::dir` of the
+	/// images found by `find` indexes into this.
+	[[nodiscard]] std::vector<std::string_view> dirs() const;
+
+	/// Appends the images named `name` to `images`.
+	void find(std::string_view name, std::vector<IconImage> &images) const;
+
+private:
+	IconCache(const unsigned char *mapping, size_t mapping_size);
+};
+
+/// A theme in one base dir, e.g. /usr/share/icons/hicolor/.
+struct ThemeRoot {
+	/// with trailing '/'
+	std::string                                              path;
+	IconCache                                                cache;
+	/// cache dir index → index into `IconTheme::dirs`, -1 if index.theme
+	/// does not list the dir
+	std::vector<int>                                         cache_dirs;
+	/// Built from the directories themselves if there is no usable cache.
+	absl::flat_hash_map<std::string, std::vector<IconImage>> index;
+};
+
+struct IconTheme {
+	std::vector<IconDir>   dirs;
+	std::vector<ThemeRoot> roots;
+};
+
+export namespace wm {
+
+/// Icon lookup in XDG icon themes, backed by their icon-theme.cache files.
+///
+/// Themes are loaded once on construction. A lookup is a hash probe into each
+/// theme's caches, in the order of the spec: the configured themes, each
+/// followed by its `Inherits=` chain, then hicolor, then the pixmaps dirs.
+/// Within a theme the directory closest to the requested size wins, with
+/// exact matches in an Applications context preferred.
+class IconThemes {
+	std::vector<IconTheme>   themes;
+	std::vector<std::string> pixmap_dirs;
+	int                      size;
+
+public:
+	/// No themes are loaded if `names` is empty.
+	IconThemes(std::span<const std::string_view> names, int size);
+
+	[[nodiscard]] bool empty() const { return themes.empty(); }
+
+	/// Absolute path of the icon named `name`, empty if no theme has it.
+	[[nodiscard]] std::string find_icon(std::string_view name) const;
+};
+
+/// `gtk-icon-theme-name` from the GTK 3 settings.ini files, empty if unset.
+[[nodiscard]] std::string get_gtk_icon_theme_name();
+
+} // namespace wm
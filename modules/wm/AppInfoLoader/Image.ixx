@@ -2,6 +2,7 @@ export module wm.AppInfoLoader.Image;
 
 import std;
 
+using std::size_t;
 using std::uint8_t;
 using std::uint32_t;
 
@@ -9,15 +10,40 @@ export namespace wm {
 enum class ImageFormat : uint8_t {
 	RGB,
 	RGBA,
+	/// Premultiplied, as cairo draws it.
 	BGRA,
+	/// What `normalize_image` produces.
+	PremultipliedRGBA,
 };
 
+/// Frees pixels allocated with new[], or unmaps them if they are part of a
+/// mapping of the decoded-icon cache.
+struct ImageDeleter {
+	/// null for new[]
+	void  *mapping      = nullptr;
+	size_t mapping_size = 0;
+
+	void operator()(uint8_t *pixels) const;
+};
+
+using ImageBuffer = std::unique_ptr<uint8_t[], ImageDeleter>;
+
 struct Image {
-	std::unique_ptr<uint8_t[]> buffer;
-	uint32_t                   width;
-	uint32_t                   height;
-	ImageFormat                format;
+	ImageBuffer buffer;
+	uint32_t    width;
+	uint32_t    height;
+	ImageFormat format;
 };
 
+/// Bytes per pixel, without padding between rows.
+[[nodiscard]] uint32_t get_pixel_size(ImageFormat format);
+
+/// Converts any format to premultiplied RGBA, in place unless `image` is
+/// RGB. `ImageCache` stores images after this, so its hits need no
+/// conversion.
+[[nodiscard]] Image normalize_image(Image image);
+
+/// Decodes a PNG, JPEG or SVG icon so that its longer side is `size`. Smaller
+/// PNGs and JPEGs are not scaled up.
 Image read_image(const char *path, int size);
 } // namespace wm
@@ -0,0 +1,63 @@
+export module wm.AppInfoLoader.ImageCache;
+
+import std;
+
+import wm.AppInfoLoader.Image;
+
+using std::int64_t, std::uint32_t, std::uint64_t;
+
+/// What a cached image was decoded from.
+struct ImageKey {
+	int64_t  mtime_ns;
+	int64_t  file_size;
+	uint32_t size;
+};
+
+export namespace wm {
+
+/// An on-disk cache of decoded icons under $XDG_CACHE_HOME/wm/icons, one file
+/// per icon and requested size. Icons are stored normalized, and a hit maps
+/// the file read-only and hands out its pixels without copying. Entries are
+/// keyed by the icon's path, mtime and file size, so an updated icon is
+/// decoded again.
+///
+/// Least recently used entries are evicted once the files exceed
+/// `max_bytes`. A hit bumps the file's mtime, which eviction orders by.
+/// Pixels that are mapped stay valid after their file is evicted.
+///
+/// Thread-safe.
+class ImageCache {
+	/// with trailing '/', empty if there is no cache dir
+	std::string dir;
+	uint64_t    max_bytes;
+	std::mutex  mtx;
+	/// size of the files in `dir`, -1 until measured by `evict`
+	int64_t     total_bytes;
+
+public:
+	static constexpr uint64_t default_max_bytes = 64 << 20;
+
+	explicit ImageCache(uint64_t max_bytes = default_max_bytes);
+
+	/// `read_image` followed by `normalize_image`, from the cache if possible.
+	/// Images decoded on a miss are added to it. The pixels of hits must not
+	/// be written to.
+	[[nodiscard]] Image read(const char *path, int size);
+
+private:
+	[[nodiscard]] static Image
+	find(const std::string &entry_path, std::string_view path, const ImageKey &key);
+
+	void store(
+	    const std::string &entry_path,
+	    std::string_view   path,
+	    const ImageKey    &key,
+	    const Image       &image
+	);
+
+	/// Measures `dir` and removes the oldest entries if it is over budget.
+	/// Called with `mtx` held.
+	void evict();
+};
+
+} // namespace wm
@@ -0,0 +1,67 @@
+export module wm.AppInfoLoader.IndexCache;
+
+import std;
+
+using std::size_t, std::int64_t, std::uint32_t;
+
+export namespace wm {
+
+/// One desktop file as seen in one directory, before XDG precedence is applied.
+struct DesktopEntry {
+	std::string_view desktop_file_id;
+	std::string_view startup_wm_class;
+	std::string_view name;
+	/// value of the Icon key, not resolved against icon themes
+	const char      *iconstring;
+	const char      *desktop_file_path;
+};
+
+/// An app dir or one of its subdirectories.
+struct DirIndex {
+	/// with trailing '/'
+	std::string_view              path;
+	/// mtime of the directory when it was scanned, -1 if it could not be stat'd
+	int64_t                       mtime_ns;
+	/// names of subdirectories (which are indexed separately)
+	std::vector<std::string_view> subdirs;
+	std::vector<DesktopEntry>     entries;
+};
+
+/// A versioned on-disk snapshot of `AppInfoLoader::scan()`'s results.
+///
+/// All strings returned by `find` point into a read-only mapping of the cache
+/// file and are null-terminated; they stay valid for the lifetime of the
+/// `IndexCache`. The file is replaced atomically when written, so an existing
+/// mapping is never modified under a reader.
+///
+/// A directory's entries are reused when its mtime is unchanged. This catches
+/// files being added, removed or renamed (which is how package managers and
+/// editors update desktop files), but not in-place edits.
+class IndexCache {
+	const char *mapping;
+	size_t      mapping_size;
+
+public:
+	IndexCache();
+	IndexCache(IndexCache &&other) noexcept;
+	IndexCache &operator=(IndexCache &&other) noexcept;
+	~IndexCache();
+
+	/// Maps the cache file if it exists and is valid.
+	[[nodiscard]] static IndexCache open();
+
+	/// Returns the cached index of `dir` if it was indexed at `mtime_ns`.
+	[[nodiscard]] std::optional<DirIndex> find(std::string_view dir, int64_t mtime_ns) const;
+
+	/// Atomically replaces the cache file. Errors are ignored; the cache is
+	/// only an optimization.
+	static void write(std::span<const DirIndex> dir_indices);
+
+private:
+	IndexCache(const char *mapping, size_t mapping_size);
+};
+
+/// mtime of `path` in nanoseconds, -1 on error.
+[[nodiscard]] int64_t get_mtime_ns(const char *path);
+
+} // namespace wm
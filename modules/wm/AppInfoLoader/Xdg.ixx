@@ -2,13 +2,28 @@ export module wm.AppInfoLoader.Xdg;
 
 import std;
 
-using std::uint64_t;
-
-auto aligned_deleter     = [](char *ptr) { ::operator delete[](ptr, std::align_val_t{32}); };
-using unique_aligned_ptr = std::unique_ptr<char, decltype(aligned_deleter)>;
+using std::size_t, std::uint8_t, std::uint64_t;
 
 export namespace wm {
 
+/// Wide enough for one AVX-512 load.
+inline constexpr size_t desktop_file_alignment = 64;
+
+/// Bytes read before checking whether the rest of a desktop file is needed.
+/// The [Desktop Entry] group usually ends well before; translated Name and
+/// Comment keys and action groups make up the bulk of large files.
+inline constexpr int desktop_file_prefix_size = 4096;
+
+/// Larger files are not read at all.
+inline constexpr int max_desktop_file_size = 16 << 20;
+
+struct aligned_deleter {
+	void operator()(char *ptr) const
+	{ ::operator delete[](ptr, std::align_val_t{desktop_file_alignment}); }
+};
+
+using unique_aligned_ptr = std::unique_ptr<char, aligned_deleter>;
+
 struct XdgAppDirs {
 	// Each dir contains trailing `/`
 	std::vector<const char *> dirs;
@@ -24,10 +39,41 @@ struct DesktopFileInfo {
 	bool operator==(const DesktopFileInfo &other) const = default;
 };
 
+/// Instruction set used by `get_desktop_file_info`.
+enum class SimdLevel : uint8_t {
+	SSE2,
+	AVX2,
+	AVX512BW,
+};
+
+/// A buffer for a desktop file of `size` bytes, in the layout
+/// `get_desktop_file_info` expects: `desktop_file_alignment`-byte aligned,
+/// with at least one aligned block past `size`, all filled with '\n'.
+[[nodiscard]] unique_aligned_ptr make_desktop_file_buffer(int size);
+
+/// Reads the first `desktop_file_prefix_size` bytes of `fd`, and the rest only
+/// if the [Desktop Entry] group does not end within them. The returned size
+/// is the number of bytes read, which may be less than the file's.
 [[nodiscard]] std::pair<unique_aligned_ptr, int> read_desktop_file(int fd);
 
+/// Whether the first `length` bytes of a desktop file of `size` bytes are
+/// all that `get_desktop_file_info` needs.
+[[nodiscard]] bool has_complete_desktop_entry(const char *data, int length, int size);
+
+/// Completes a read of the first `length` bytes of a desktop file of `size`
+/// bytes.
+[[nodiscard]] std::pair<unique_aligned_ptr, int>
+read_desktop_file_rest(int fd, unique_aligned_ptr prefix, int length, int size);
+
+/// Uses the best `SimdLevel` the CPU supports.
 [[nodiscard]] DesktopFileInfo get_desktop_file_info(const char *data, int size);
 
+/// For tests and benchmarks. `level` must be supported by the CPU.
+[[nodiscard]] DesktopFileInfo get_desktop_file_info(const char *data, int size, SimdLevel level);
+
+/// Best level supported by the CPU, detected once.
+[[nodiscard]] SimdLevel get_simd_level();
+
 [[nodiscard]] XdgAppDirs get_xdg_app_dirs();
 
 } // namespace wm
@@ -15,6 +15,7 @@ import hyprutils.memory;
 import absl;
 
 import wm.AppInfoLoader;
+import wm.Support.ShelfPacker;
 
 using Config::Values::CColorValue;
 using Config::Values::CStringValue;
@@ -22,6 +23,7 @@ using Config::Values::CIntValue;
 using Config::Values::CFloatValue;
 using Hyprutils::Math::CBox;
 using Hyprutils::Math::CRegion;
+using Hyprutils::Math::Mat3x3;
 using Hyprutils::Math::Vector2D;
 using Hyprutils::Memory::CSharedPointer;
 using Hyprutils::Memory::CUniquePointer;
@@ -30,6 +32,122 @@ export namespace wm {
 
 struct IconPending {};
 
+/// An icon in `IconAtlas`.
+struct AtlasSlot {
+	uint32_t id;
+};
+
+/// What an app shows in the switcher.
+using IconState = std::variant<std::monostate, IconPending, AtlasSlot>;
+
+struct AtlasQuad {
+	CBox      box;
+	AtlasSlot slot;
+};
+
+/// The switcher's icons, drawn into a texture of their own. Frames where
+/// only the selection moves draw it as one quad instead of every icon.
+struct IconLayer {
+	/// What the texture holds, in monitor pixels.
+	CBox                   box;
+	std::vector<AtlasQuad> quads;
+	uint64_t               atlas_generation = 0;
+	uint32_t               framebuffer      = 0;
+	uint32_t               texture          = 0;
+	uint32_t               width            = 0;
+	uint32_t               height           = 0;
+
+	IconLayer()                             = default;
+	IconLayer(const IconLayer &)            = delete;
+	IconLayer &operator=(const IconLayer &) = delete;
+	~IconLayer();
+
+	/// Whether the texture already holds `quads` drawn into `box`.
+	[[nodiscard]] bool
+	is_current(const CBox &box, std::span<const AtlasQuad> quads, uint64_t generation) const;
+};
+
+/// Keeps all icons in one RGBA texture, so that the switcher draws them with
+/// one bind and one draw call. The pixels are kept on the CPU too, which
+/// lets the atlas grow and compact without reading the texture back.
+///
+/// Uploads go through a pixel buffer object and are spread over frames by
+/// a time and size budget. Only icons that are drawn get uploaded; until
+/// then they are drawn as a placeholder.
+class IconAtlas {
+	struct Slot {
+		/// Includes the gutter.
+		PackedRect rect;
+		/// Where the icon is in the texture, valid if `uploaded`. Differs
+		/// from `rect` after a repack until the texture is reallocated.
+		uint32_t   texture_x;
+		uint32_t   texture_y;
+		bool       uploaded;
+	};
+
+	ShelfPacker                                 packer;
+	absl::flat_hash_map<uint32_t, Slot>         slots;
+	std::vector<uint8_t>                        pixels;
+	std::vector<std::pair<Slot *, std::size_t>> upload_batch;
+	std::vector<float>                          vertices;
+	AtlasSlot                                   placeholder;
+	uint32_t                                    next_id;
+	/// Changes whenever an icon's pixels or texture coordinates do.
+	uint64_t                                    generation;
+	uint32_t                                    texture;
+	/// Size of the texture's storage, 0 when it has to be reallocated.
+	uint32_t                                    texture_size;
+	uint32_t                                    pbo;
+	uint32_t                                    program;
+	int                                         proj_location;
+	int                                         tex_location;
+	uint32_t                                    vao;
+	uint32_t                                    vbo;
+
+public:
+	static constexpr uint32_t initial_size = 512;
+	// the largest size every GLES 3 driver supports
+	static constexpr uint32_t max_size     = 2048;
+	// well below a frame even at 240 Hz
+	static constexpr std::chrono::microseconds upload_budget{1000};
+	static constexpr std::size_t               upload_budget_bytes = 1 << 20;
+
+	IconAtlas();
+	IconAtlas(const IconAtlas &)            = delete;
+	IconAtlas &operator=(const IconAtlas &) = delete;
+	~IconAtlas();
+
+	/// Copies `image` into the atlas; it's uploaded by later `draw` calls.
+	/// Returns nullopt if the atlas is full even at `max_size`.
+	[[nodiscard]] std::optional<AtlasSlot> add(const Image &image);
+	void                                   remove(AtlasSlot slot);
+	/// Drawn in place of icons that are still decoding or uploading.
+	[[nodiscard]] AtlasSlot                get_placeholder() const { return placeholder; }
+	/// Whether any of `quads` still has to be uploaded.
+	[[nodiscard]] bool has_pending_uploads(std::span<const AtlasQuad> quads) const;
+	/// Uploads what fits in the budget, draws `quads`, whose boxes are in
+	/// monitor pixels inside `box`, into `layer` if it doesn't hold them yet,
+	/// then draws the layer.
+	void draw(
+	    IconLayer &layer, std::span<const AtlasQuad> quads, const CBox &box,
+	    const Mat3x3 &projection
+	);
+
+private:
+	AtlasSlot add_slot(const PackedRect &rect);
+	/// Moves the live icons into a new packing of `size` with room for one
+	/// more rectangle, which is returned.
+	std::optional<PackedRect> repack(uint32_t size, uint32_t width, uint32_t height);
+	void                      reallocate(uint32_t size);
+	void                      upload(std::span<const AtlasQuad> quads);
+	bool                      init_program();
+	[[nodiscard]] std::optional<std::array<float, 4>> get_uv(AtlasSlot slot) const;
+	void append_quad(const CBox &box, std::array<float, 4> uv, Vector2D origin = {});
+	/// Draws the quads appended so far with `source` bound.
+	void flush(uint32_t source, const Mat3x3 &projection);
+	void render_layer(IconLayer &layer, const CBox &box, std::span<const AtlasQuad> quads);
+};
+
 struct ShadowConfig {
 	bool       enabled;
 	bool       sharp;
@@ -44,11 +162,40 @@ struct SolidSurface {
 	float                            opacity;
 };
 
+/// Boxes of the switcher on one monitor, in monitor pixels.
+struct SwitcherLayout {
+	Vector2D                   monitor_position;
+	Vector2D                   monitor_size;
+	double                     monitor_scale = 0.0;
+	std::size_t                num_icons     = 0;
+	/// Cells of the grid, of which `rows` are shown at once.
+	std::size_t                columns  = 0;
+	std::size_t                rows     = 0;
+	std::size_t                num_rows = 0;
+	CBox                       container_box;
+	/// One per visible cell, row by row.
+	std::vector<CBox>          icon_boxes;
+	/// The shadow box, or the container box expanded by the border.
+	CBox                       outer_box;
+	CBox                       shadow_box;
+	int                        shadow_range = 0;
+	int                        shadow_round = 0;
+	int                        border_size  = 0;
+	bool                       has_shadow   = false;
+	/// Created with the layout, drawn by the first frame on the monitor.
+	std::unique_ptr<IconLayer> icon_layer;
+};
+
 struct AppStuff {
-	llvm::SmallVector<PHLWINDOWREF>                                             windows;
-	std::string_view                                                            app_name;
-	// shared pointer is used because Hyprland "needs" it
-	std::variant<std::monostate, IconPending, CSharedPointer<Render::ITexture>> icon_texture;
+	llvm::SmallVector<PHLWINDOWREF> windows;
+	std::string_view                app_name;
+	IconState                       icon_texture;
+};
+
+struct SharedIcon {
+	std::variant<std::monostate, std::shared_future<Image>, AtlasSlot> icon;
+	/// entries of `AppSwitcher::app_icon_paths` with this icon
+	uint32_t                                                           users;
 };
 
 struct AppSwitcherConfig {
@@ -72,15 +219,21 @@ public: // TODO: clean (zero-overhead) abstractions without duplicating methods
 	AppInfoLoader app_info_loader;
 
 private:
-	// shared pointer is used because Hyprland "needs" it
-	absl::flat_hash_map<
-	    const char *,
-	    std::variant<std::monostate, std::future<Image>, CSharedPointer<Render::ITexture>>>
-	                                                   icon_texture_cache;
+	/// App IDs to their icon paths, which the loader interns. Null for apps
+	/// without an icon.
+	absl::flat_hash_map<const char *, const char *>    app_icon_paths;
+	/// Icon paths to the icon all apps with that path share.
+	absl::flat_hash_map<const char *, SharedIcon>      icon_texture_cache;
+	IconAtlas                                          icon_atlas;
+	/// Apps whose icons are kept without open windows, because they are
+	/// likely to be launched.
+	absl::flat_hash_set<const char *>                  prefetched_app_ids;
 	std::vector<const char *>                         *app_id_focus_history;
 	absl::flat_hash_map<const char *, AppStuff>       *app_stuff_map;
 	std::chrono::time_point<std::chrono::system_clock> first_tab_press;
 	wl_event_source                                   *timer;
+	/// Damages the switcher again while icons are left to upload.
+	wl_event_source                                   *upload_idle;
 	bool                                               active;
 	bool                                               visible;
 
@@ -88,8 +241,10 @@ public:
 	bool dirty;
 
 private:
-	int      idx;
-	uint32_t max_entries;
+	int         idx;
+	/// First row of the grid that is shown, scrolled to keep `idx` visible.
+	std::size_t first_row;
+	uint32_t    max_entries;
 
 	int                        container_radius;
 	int                        selection_radius;
@@ -104,8 +259,14 @@ private:
 	Config::CGradientValueData container_border_gradient;
 
 	AppSwitcherConfig config;
+	/// Cleared when the config is reloaded.
+	absl::flat_hash_map<const CMonitor *, SwitcherLayout> layouts;
 
 public:
+	/// How much of the monitor the switcher may cover before it wraps icons
+	/// into rows, and then scrolls the rows.
+	static constexpr double max_monitor_fraction = 0.9;
+
 	explicit AppSwitcher(const AppSwitcherConfig &config);
 
 	void reset_config();
@@ -119,21 +280,71 @@ public:
 	void               focus_selected();
 	void               deactivate();
 	void               on_close_app(const char *closing_app_id);
-	std::variant<std::monostate, IconPending, CSharedPointer<Render::ITexture>>
-	     load_app_icon(const char *app_id);
+	/// `priority` is the app's position in the focus history, or 0 for apps
+	/// about to be focused.
+	IconState load_app_icon(const char *app_id, uint32_t priority);
+	/// Decodes the icons of `app_ids` at the lowest priority and keeps them
+	/// when the cache is pruned, so that they're ready when the apps open.
+	/// Replaces the apps of the previous call.
+	void      prefetch_app_icons(std::span<const char *const> app_ids);
 	void prune_cache(std::span<const char *> app_ids_to_keep);
+	/// Uploads the icons the loader finished decoding and shows them in place
+	/// of their apps' pending icons. Looks up the icon paths that had to wait.
+	void on_icons_ready(
+	    std::span<const char *const>                 app_id_focus_history,
+	    absl::flat_hash_map<const char *, AppStuff> &app_stuff_map
+	);
 
 private:
 	void load_config();
 	void load_icon_textures();
-	[[nodiscard]] CBox
-	get_shadow_box(const CBox &, const ShadowConfig &, double monitor_scale) const;
-	[[nodiscard]] std::expected<CBox, std::monostate>      get_container_box() const;
+	/// Adds `shared` to the atlas if its decode has finished.
+	void upload_icon(SharedIcon &shared);
+	/// Drops an app's reference to its icon. The last one cancels the decode
+	/// if it hasn't started.
+	void release_app_icon(const char *icon_path);
+	/// The focused monitor's layout, recomputed only when the monitor's size
+	/// or scale or the number of icons changed. Null without a monitor.
+	[[nodiscard]] const SwitcherLayout *get_layout();
+	void update_layout(SwitcherLayout &, const Vector2D &, double scale, std::size_t) const;
+	/// Null if the selected icon is scrolled out of view.
+	[[nodiscard]] std::optional<CBox> get_selection_box(const SwitcherLayout &layout) const;
+	/// Damages `box`, in the layout's monitor pixels, as few logical pixels
+	/// as cover it.
+	void damage(const SwitcherLayout &layout, const CBox &box) const;
+	/// Scrolls the least needed to show the selected icon.
+	void scroll_to_selection(const SwitcherLayout &layout);
 	[[gnu::hot]] std::vector<CUniquePointer<IPassElement>> render();
 
 	friend class AppSwitcherPassElement;
 };
 
+/// The switcher's icons, drawn from `IconAtlas` at once.
+class IconStripPassElement final : public IPassElement {
+public:
+	IconStripPassElement(
+	    IconAtlas *atlas, IconLayer *layer, std::vector<AtlasQuad> quads, const CBox &box
+	);
+	~IconStripPassElement() override = default;
+
+	std::vector<CUniquePointer<IPassElement>> draw() override;
+	bool                                      needsLiveBlur() override;
+	bool                                      needsPrecomputeBlur() override;
+	std::optional<CBox>                       boundingBox() override;
+	CRegion                                   opaqueRegion() override;
+
+	static constexpr const char *pass_name = "IconStripPassElement";
+
+	const char      *passName() override { return pass_name; }
+	ePassElementType type() override { return EK_CUSTOM; }
+
+private:
+	IconAtlas             *atlas;
+	IconLayer             *layer;
+	std::vector<AtlasQuad> quads;
+	CBox                   box;
+};
+
 class AppSwitcherPassElement final : public IPassElement {
 public:
 	explicit AppSwitcherPassElement(AppSwitcher *instance);
@@ -0,0 +1,46 @@
+export module wm.Support.ShelfPacker;
+
+import std;
+
+export namespace wm {
+
+using std::uint32_t, std::uint64_t;
+
+struct PackedRect {
+	uint32_t x;
+	uint32_t y;
+	uint32_t width;
+	uint32_t height;
+};
+
+/// Packs rectangles into rows ("shelves") of a fixed area. Freed space is
+/// only reclaimed by `reset`, so callers repack when `live_area` drops far
+/// below what the shelves span.
+class ShelfPacker {
+	struct Shelf {
+		uint32_t y;
+		uint32_t height;
+		uint32_t used_width;
+	};
+
+	std::vector<Shelf> shelves;
+	uint32_t           area_width;
+	uint32_t           area_height;
+	uint64_t           used_area;
+
+public:
+	ShelfPacker(uint32_t width, uint32_t height);
+
+	/// Returns nullopt when no shelf has room and no new shelf fits.
+	[[nodiscard]] std::optional<PackedRect> insert(uint32_t width, uint32_t height);
+	void                                    remove(const PackedRect &rect);
+	/// Forgets all rectangles and changes the area.
+	void                                    reset(uint32_t width, uint32_t height);
+
+	[[nodiscard]] uint32_t width() const { return area_width; }
+	[[nodiscard]] uint32_t height() const { return area_height; }
+	/// Area of the rectangles inserted and not removed.
+	[[nodiscard]] uint64_t live_area() const { return used_area; }
+};
+
+} // namespace wm
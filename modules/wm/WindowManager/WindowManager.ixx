@@ -1,3 +1,7 @@
+module;
+
+#include <wayland-server-core.h>
+
 export module wm.WindowManager;
 
 import std;
@@ -47,17 +51,28 @@ class WindowManager {
 	/// If the desktop file for an app ID is not found, app ID is stored here.
 	/// No BumpPtrAllocator because this is rare and can be used adversarially.
 	OwnedStringPool                             app_id_pool;
+	/// Classes the dispatchers launch, whose icons are decoded before their
+	/// first window opens.
+	std::vector<std::string>                    prefetch_classes;
+	/// Classes reported since the last `reset_config`, i.e. by the Lua config
+	/// run that is in progress. They replace `prefetch_classes` once it ends.
+	std::vector<std::string>                    next_prefetch_classes;
 
 public:
 	absl::flat_hash_map<CWindow *, WindowInfo> window_info_map;
 
 private:
-	WindowSwitcher window_switcher;
-	AppSwitcher    app_switcher;
+	WindowSwitcher   window_switcher;
+	AppSwitcher      app_switcher;
+	wl_event_source *desktop_file_watch;
+	wl_event_source *icon_ready_watch;
+	wl_event_source *scan_finished_watch;
 
 public:
 	explicit WindowManager(const WindowManagerConfig &config);
 
+	~WindowManager();
+
 	void reset_config();
 
 	void on_open_window(const PHLWINDOW &window);
@@ -80,12 +95,22 @@ public:
 
 	ActionResult dump_debug_info();
 
+	/// Decodes the icon of an app that is likely to be launched, e.g. by a
+	/// dispatcher, ahead of time.
+	void prefetch_app(std::string_view hl_class);
+
 	[[nodiscard]] bool is_app_switcher_active() const;
 
 private:
 	std::tuple<const char *, std::string_view, DesktopFileStatus>
 	               resolve_app_id(std::string_view hl_class);
 	AppEntryResult get_or_create_app_entry(std::string_view hl_class);
+	/// Re-resolves the app IDs of all open apps after app info changed.
+	void           refresh_app_entries();
+	void           on_desktop_files_changed();
+	/// Resolves the windows restored at startup and prefetches icons.
+	void           on_scan_finished();
+	void           prefetch_icons();
 	void           handle_window_switching(bool backwards);
 	void           handle_app_switching(bool backwards);
 	/// If `window` exists in `window_info_map` and is currently not
@@ -85,6 +85,9 @@ static int lua_wm_dispatch_factory(lua_State *L)
 	}
 	lua_getfield(L, 1, "class");
 	lua_getfield(L, 1, "cmd");
+	// bound apps are likely to be launched, so their icons should be ready
+	if (lua_isstring(L, 2))
+		window_manager->prefetch_app(lua_tostring(L, 2));
 	lua_pushcclosure(L, F, 2);
 	return 1;
 }
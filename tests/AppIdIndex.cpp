@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+
+import std;
+
+import wm.AppInfoLoader.AppIdIndex;
+
+using std::uint32_t;
+using namespace wm;
+
+TEST(AppIdIndexTest, FindsEveryKey)
+{
+	std::vector<std::string> keys;
+	for (int i = 0; i < 10000; i++)
+		keys.push_back(std::format("org.example.App{}", i));
+	keys.emplace_back("");
+	keys.emplace_back("short");
+
+	std::vector<std::pair<std::string_view, uint32_t>> entries;
+	for (const auto &[i, key] : keys | std::views::enumerate)
+		entries.emplace_back(key, static_cast<uint32_t>(i * 3));
+
+	AppIdIndex index(entries);
+	ASSERT_EQ(index.size(), keys.size());
+	for (const auto &[key, value] : entries) {
+		auto [found, found_value] = index.find(key);
+		ASSERT_EQ(found, key.data()) << key;
+		EXPECT_EQ(found_value, value) << key;
+	}
+}
+
+TEST(AppIdIndexTest, RejectsKeysThatOnlyShareTheFingerprint)
+{
+	std::string keys[] = {"org.mozilla.firefox", "kitty"};
+
+	std::vector<std::pair<std::string_view, uint32_t>> entries{{keys[0], 0}, {keys[1], 1}};
+	AppIdIndex                                         index(entries);
+
+	EXPECT_EQ(index.find("org.mozilla.thunderbird").first, nullptr);
+	// same length and first 8 bytes
+	EXPECT_EQ(index.find("org.mozilla.firefix").first, nullptr);
+	EXPECT_EQ(index.find("kitt").first, nullptr);
+	EXPECT_EQ(index.find("kitty2").first, nullptr);
+	EXPECT_EQ(index.find("kitty").second, 1u);
+}
+
+static void expect_finds_all(std::size_t num_keys, std::uint64_t seed)
+{
+	std::vector<std::string> keys;
+	for (std::size_t i = 0; i < num_keys; i++)
+		keys.push_back(std::format("app{}.{}", seed, i));
+
+	std::vector<std::pair<std::string_view, uint32_t>> entries;
+	for (const auto &[i, key] : keys | std::views::enumerate)
+		entries.emplace_back(key, static_cast<uint32_t>(i));
+
+	AppIdIndex index(entries, seed);
+	ASSERT_EQ(index.size(), num_keys);
+	for (const auto &[key, value] : entries) {
+		auto [found, found_value] = index.find(key);
+		ASSERT_EQ(found, key.data()) << key << " seed " << seed;
+		EXPECT_EQ(found_value, value) << key;
+	}
+}
+
+// the slot count equals the key count, so these used to lose all but the
+// low bits of the hash
+TEST(AppIdIndexTest, BuildsPowerOfTwoKeyCounts)
+{
+	for (std::size_t num_keys = 1; num_keys <= 4096; num_keys *= 2)
+		expect_finds_all(num_keys, 0);
+}
+
+TEST(AppIdIndexTest, BuildsForManySeeds)
+{
+	std::mt19937_64 rng(42);
+	for (int i = 0; i < 200; i++) {
+		for (std::size_t num_keys : {2, 3, 8, 37, 256})
+			expect_finds_all(num_keys, rng());
+	}
+}
+
+TEST(AppIdIndexTest, EmptyIndexFindsNothing)
+{
+	AppIdIndex index;
+	EXPECT_EQ(index.size(), 0u);
+	EXPECT_EQ(index.find("foo").first, nullptr);
+}
@@ -1,5 +1,7 @@
 #include <fcntl.h>
 #include <gtest/gtest.h>
+#include <poll.h>
+#include <sys/stat.h>
 
 import std;
 import llvm.Support;
@@ -36,28 +38,50 @@ void write_desktop_file(llvm::StringRef dir, llvm::StringRef filename, llvm::Str
 		throw std::runtime_error("short write to memfd");
 }
 
+llvm::SmallString<256> app_dir(llvm::StringRef base)
+{
+	llvm::SmallString<256> path(base);
+	llvm::sys::path::append(path, "applications");
+	return path;
+}
+
+/// Directory mtimes have coarse granularity, so make sure a change is visible.
+void bump_mtime(const llvm::SmallString<256> &path)
+{
+	struct stat st;
+	ASSERT_EQ(stat(path.c_str(), &st), 0) << std::strerror(errno);
+	struct timespec times[2] = {
+	    {.tv_sec = 0, .tv_nsec = UTIME_OMIT},
+	    {.tv_sec = st.st_mtim.tv_sec + 1, .tv_nsec = st.st_mtim.tv_nsec},
+	};
+	ASSERT_EQ(utimensat(AT_FDCWD, path.c_str(), times, 0), 0) << std::strerror(errno);
+}
+
+void wait_until_available(AppInfoLoader &loader)
+{
+	for (int i = 0; i < 1000 && !loader.is_available(); i++)
+		std::this_thread::sleep_for(1ms);
+}
+
 class AppInfoLoaderTest : public testing::Test {
 protected:
 	llvm::SmallString<256> data_home;
 	llvm::SmallString<256> data_dir1;
 	llvm::SmallString<256> data_dir2;
+	llvm::SmallString<256> cache_home;
 
 	void SetUp() override
 	{
-		data_home = make_temp_dir();
-		data_dir1 = make_temp_dir();
-		data_dir2 = make_temp_dir();
+		data_home  = make_temp_dir();
+		data_dir1  = make_temp_dir();
+		data_dir2  = make_temp_dir();
+		cache_home = make_temp_dir();
 
 		setenv("XDG_DATA_HOME", data_home.c_str(), 1);
 		llvm::SmallString<256> dirs;
 		std::format_to(std::back_inserter(dirs), "{}:{}", data_dir1.c_str(), data_dir2.c_str());
 		setenv("XDG_DATA_DIRS", dirs.c_str(), 1);
-
-		auto app_dir = [](llvm::StringRef base) {
-			llvm::SmallString<256> path(base);
-			llvm::sys::path::append(path, "applications");
-			return path;
-		};
+		setenv("XDG_CACHE_HOME", cache_home.c_str(), 1);
 
 		write_desktop_file(
 		    app_dir(data_home), "foo.desktop", "[Desktop Entry]\nName=Foo\nIcon=foo\n"
@@ -79,6 +103,7 @@ protected:
 		auto _ = fs::remove_directories(data_home);
 		auto _ = fs::remove_directories(data_dir1);
 		auto _ = fs::remove_directories(data_dir2);
+		auto _ = fs::remove_directories(cache_home);
 	}
 };
 
@@ -103,3 +128,266 @@ TEST_F(AppInfoLoaderTest, ScansAndResolvesAppInfo)
 	ASSERT_STREQ(bar.app_id, "bar");
 	EXPECT_EQ(bar.name, "Bar");
 }
+
+TEST_F(AppInfoLoaderTest, ReusesIndexCacheForUnchangedDirs)
+{
+	AppInfoLoaderConfig config{.icon_size = 12, .icon_theme = ""};
+	{
+		AppInfoLoader loader(config);
+		wait_until_available(loader);
+		ASSERT_TRUE(loader.is_available()) << "scan did not finish in time";
+	}
+
+	llvm::SmallString<256> cache_file(cache_home);
+	llvm::sys::path::append(cache_file, "wm", "app-index");
+	ASSERT_TRUE(fs::exists(cache_file));
+
+	write_desktop_file(app_dir(data_dir1), "baz.desktop", "[Desktop Entry]\nName=Baz\n");
+	bump_mtime(app_dir(data_dir1));
+
+	AppInfoLoader loader(config);
+	wait_until_available(loader);
+	ASSERT_TRUE(loader.is_available()) << "scan did not finish in time";
+
+	auto foo = loader.get_app_info("foo");
+	ASSERT_STREQ(foo.app_id, "foo");
+	EXPECT_EQ(foo.name, "Foo");
+
+	auto baz = loader.get_app_info("baz");
+	ASSERT_STREQ(baz.app_id, "baz");
+	EXPECT_EQ(baz.name, "Baz");
+
+	auto bar = loader.get_app_info("bar");
+	ASSERT_STREQ(bar.app_id, "bar");
+	EXPECT_EQ(bar.name, "Bar");
+}
+
+TEST_F(AppInfoLoaderTest, AppliesWatchedChangesWithPrecedence)
+{
+	AppInfoLoaderConfig config{.icon_size = 12, .icon_theme = ""};
+	AppInfoLoader       loader(config);
+	wait_until_available(loader);
+	ASSERT_TRUE(loader.is_available()) << "scan did not finish in time";
+
+	llvm::SmallString<256> shadowing(app_dir(data_dir1));
+	llvm::sys::path::append(shadowing, "bar.desktop");
+	ASSERT_FALSE(fs::remove(shadowing));
+	write_desktop_file(app_dir(data_home), "baz.desktop", "[Desktop Entry]\nName=Baz\n");
+
+	EXPECT_TRUE(loader.process_watch_events());
+
+	auto bar = loader.get_app_info("bar");
+	ASSERT_STREQ(bar.app_id, "bar");
+	EXPECT_EQ(bar.name, "OtherBar");
+
+	auto custom = loader.get_app_info("custom");
+	EXPECT_EQ(custom.app_id, nullptr);
+
+	auto baz = loader.get_app_info("baz");
+	ASSERT_STREQ(baz.app_id, "baz");
+	EXPECT_EQ(baz.name, "Baz");
+}
+
+TEST_F(AppInfoLoaderTest, ReusesRecordsOfRewrittenFiles)
+{
+	AppInfoLoaderConfig config{.icon_size = 12, .icon_theme = ""};
+	AppInfoLoader       loader(config);
+	wait_until_available(loader);
+	ASSERT_TRUE(loader.is_available()) << "scan did not finish in time";
+
+	for (int i = 0; i < 3; i++) {
+		auto name = std::format("Bar{}", i);
+		write_desktop_file(
+		    app_dir(data_dir1),
+		    "bar.desktop",
+		    std::format("[Desktop Entry]\nName={}\nStartupWMClass=custom\n", name)
+		);
+		EXPECT_TRUE(loader.process_watch_events());
+
+		auto bar = loader.get_app_info("bar");
+		ASSERT_STREQ(bar.app_id, "bar");
+		EXPECT_EQ(bar.name, name);
+
+		auto custom = loader.get_app_info("custom");
+		ASSERT_STREQ(custom.app_id, "custom");
+		EXPECT_EQ(custom.name, name);
+	}
+
+	auto foo = loader.get_app_info("foo");
+	ASSERT_STREQ(foo.app_id, "foo");
+	EXPECT_EQ(foo.name, "Foo");
+}
+
+TEST_F(AppInfoLoaderTest, ScansSubdirectoriesWithPrefixedIds)
+{
+	llvm::SmallString<256> vendor_dir(app_dir(data_home));
+	llvm::sys::path::append(vendor_dir, "vendor");
+	write_desktop_file(vendor_dir, "app.desktop", "[Desktop Entry]\nName=VendorApp\n");
+	write_desktop_file(
+	    app_dir(data_dir1), "vendor-app.desktop", "[Desktop Entry]\nName=Shadowed\n"
+	);
+
+	llvm::SmallString<256> nested_dir(vendor_dir);
+	llvm::sys::path::append(nested_dir, "nested");
+	write_desktop_file(nested_dir, "tool.desktop", "[Desktop Entry]\nName=Tool\n");
+
+	AppInfoLoaderConfig config{.icon_size = 12, .icon_theme = ""};
+	AppInfoLoader       loader(config);
+	wait_until_available(loader);
+	ASSERT_TRUE(loader.is_available()) << "scan did not finish in time";
+
+	auto app = loader.get_app_info("vendor-app");
+	ASSERT_STREQ(app.app_id, "vendor-app");
+	EXPECT_EQ(app.name, "VendorApp");
+
+	auto tool = loader.get_app_info("vendor-nested-tool");
+	ASSERT_STREQ(tool.app_id, "vendor-nested-tool");
+	EXPECT_EQ(tool.name, "Tool");
+
+	auto bar = loader.get_app_info("bar");
+	ASSERT_STREQ(bar.app_id, "bar");
+	EXPECT_EQ(bar.name, "Bar");
+}
+
+TEST_F(AppInfoLoaderTest, WatchesNewSubdirectories)
+{
+	AppInfoLoaderConfig config{.icon_size = 12, .icon_theme = ""};
+	AppInfoLoader       loader(config);
+	wait_until_available(loader);
+	ASSERT_TRUE(loader.is_available()) << "scan did not finish in time";
+
+	llvm::SmallString<256> vendor_dir(app_dir(data_dir2));
+	llvm::sys::path::append(vendor_dir, "vendor");
+	write_desktop_file(vendor_dir, "app.desktop", "[Desktop Entry]\nName=VendorApp\n");
+
+	EXPECT_TRUE(loader.process_watch_events());
+
+	auto app = loader.get_app_info("vendor-app");
+	ASSERT_STREQ(app.app_id, "vendor-app");
+	EXPECT_EQ(app.name, "VendorApp");
+
+	ASSERT_FALSE(fs::remove_directories(vendor_dir));
+
+	EXPECT_TRUE(loader.process_watch_events());
+
+	auto removed = loader.get_app_info("vendor-app");
+	EXPECT_EQ(removed.app_id, nullptr);
+}
+
+TEST_F(AppInfoLoaderTest, WatchesAppDirsThatAppearLater)
+{
+	// as on a fresh account, where not even ~/.local/share exists yet
+	llvm::SmallString<256> missing_home(data_home);
+	llvm::sys::path::append(missing_home, "local", "share");
+	setenv("XDG_DATA_HOME", missing_home.c_str(), 1);
+
+	AppInfoLoaderConfig config{.icon_size = 12, .icon_theme = ""};
+	AppInfoLoader       loader(config);
+	wait_until_available(loader);
+	ASSERT_TRUE(loader.is_available()) << "scan did not finish in time";
+	EXPECT_EQ(loader.get_app_info("late").app_id, nullptr);
+
+	write_desktop_file(app_dir(missing_home), "late.desktop", "[Desktop Entry]\nName=Late\n");
+	EXPECT_TRUE(loader.process_watch_events());
+
+	auto late = loader.get_app_info("late");
+	ASSERT_STREQ(late.app_id, "late");
+	EXPECT_EQ(late.name, "Late");
+
+	// watched directly from now on
+	write_desktop_file(app_dir(missing_home), "later.desktop", "[Desktop Entry]\nName=Later\n");
+	EXPECT_TRUE(loader.process_watch_events());
+	EXPECT_STREQ(loader.get_app_info("later").app_id, "later");
+}
+
+TEST_F(AppInfoLoaderTest, ResolvesIconsOnFirstRequest)
+{
+	write_desktop_file(
+	    app_dir(data_home), "abs.desktop", "[Desktop Entry]\nName=Abs\nIcon=/nonexistent/abs.png\n"
+	);
+	write_desktop_file(app_dir(data_home), "noicon.desktop", "[Desktop Entry]\nName=NoIcon\n");
+
+	AppInfoLoaderConfig config{.icon_size = 12, .icon_theme = ""};
+	AppInfoLoader       loader(config);
+	wait_until_available(loader);
+	ASSERT_TRUE(loader.is_available()) << "scan did not finish in time";
+
+	EXPECT_TRUE(loader.get_app_icon("abs").has_value());
+	// memoized
+	EXPECT_TRUE(loader.get_app_icon("abs").has_value());
+	EXPECT_FALSE(loader.get_app_icon("noicon").has_value());
+	EXPECT_FALSE(loader.get_app_icon("missing").has_value());
+}
+
+TEST_F(AppInfoLoaderTest, SharesIconPathsBetweenApps)
+{
+	write_desktop_file(
+	    app_dir(data_home), "one.desktop", "[Desktop Entry]\nName=One\nIcon=/nonexistent/pwa.png\n"
+	);
+	write_desktop_file(
+	    app_dir(data_home), "two.desktop", "[Desktop Entry]\nName=Two\nIcon=/nonexistent/pwa.png\n"
+	);
+
+	AppInfoLoaderConfig config{.icon_size = 12, .icon_theme = ""};
+	AppInfoLoader       loader(config);
+	wait_until_available(loader);
+	ASSERT_TRUE(loader.is_available()) << "scan did not finish in time";
+
+	auto *one = loader.get_app_icon_path("one").value_or(nullptr);
+	ASSERT_STREQ(one, "/nonexistent/pwa.png");
+	EXPECT_EQ(loader.get_app_icon_path("two"), one);
+
+	auto icon = loader.load_icon(one);
+	EXPECT_FALSE(icon.get().buffer);
+}
+
+TEST_F(AppInfoLoaderTest, SignalsFinishedDecodesOnEventFd)
+{
+	write_desktop_file(
+	    app_dir(data_home), "abs.desktop", "[Desktop Entry]\nName=Abs\nIcon=/nonexistent/abs.png\n"
+	);
+
+	AppInfoLoaderConfig config{.icon_size = 12, .icon_theme = ""};
+	AppInfoLoader       loader(config);
+	wait_until_available(loader);
+	ASSERT_TRUE(loader.is_available()) << "scan did not finish in time";
+	ASSERT_NE(loader.ready_icons_fd(), -1);
+
+	auto *icon_path = loader.get_app_icon_path("abs").value_or(nullptr);
+	ASSERT_NE(icon_path, nullptr);
+	auto icon = loader.load_icon(icon_path);
+
+	pollfd pfd{.fd = loader.ready_icons_fd(), .events = POLLIN, .revents = 0};
+	ASSERT_EQ(poll(&pfd, 1, 5000), 1);
+	EXPECT_EQ(icon.wait_for(0s), std::future_status::ready);
+	EXPECT_EQ(loader.take_ready_icons(), std::vector<const char *>{icon_path});
+
+	// drained together with the list
+	EXPECT_EQ(poll(&pfd, 1, 0), 0);
+	EXPECT_TRUE(loader.take_ready_icons().empty());
+}
+
+TEST_F(AppInfoLoaderTest, LooksUpThemedIconsOffTheCallingThread)
+{
+	write_desktop_file(
+	    app_dir(data_home), "themed.desktop", "[Desktop Entry]\nName=Themed\nIcon=no-such-icon\n"
+	);
+
+	AppInfoLoaderConfig config{.icon_size = 12, .icon_theme = ""};
+	AppInfoLoader       loader(config);
+	wait_until_available(loader);
+	ASSERT_TRUE(loader.is_available()) << "scan did not finish in time";
+	ASSERT_NE(loader.ready_icons_fd(), -1);
+
+	// the themes are loaded, then nk is asked, each signalling the event fd
+	pollfd pfd{.fd = loader.ready_icons_fd(), .events = POLLIN, .revents = 0};
+	auto   icon_path = loader.get_app_icon_path("themed");
+	for (int i = 0; !icon_path && i < 10; i++) {
+		ASSERT_EQ(poll(&pfd, 1, 5000), 1);
+		EXPECT_TRUE(loader.take_ready_icons().empty());
+		icon_path = loader.get_app_icon_path("themed");
+	}
+	ASSERT_TRUE(icon_path.has_value());
+	EXPECT_EQ(*icon_path, nullptr);
+	EXPECT_FALSE(loader.get_app_icon("themed").has_value());
+}
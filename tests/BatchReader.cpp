@@ -0,0 +1,78 @@
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+import std;
+import llvm.Support;
+
+import wm.AppInfoLoader.BatchReader;
+import wm.AppInfoLoader.Xdg;
+
+using std::size_t;
+using namespace wm;
+namespace fs = llvm::sys::fs;
+
+class BatchReaderTest : public testing::Test {
+protected:
+	llvm::SmallString<256> dir;
+	int                    dfd = -1;
+
+	void SetUp() override
+	{
+		if (auto ec = fs::createUniqueDirectory("batch_reader_test", dir))
+			throw std::runtime_error(ec.message());
+		dfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		ASSERT_NE(dfd, -1) << std::strerror(errno);
+	}
+
+	void TearDown() override
+	{
+		close(dfd);
+		auto _ = fs::remove_directories(dir);
+	}
+
+	void write_file(const std::string &filename, std::string_view content)
+	{
+		int fd = openat(dfd, filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		ASSERT_NE(fd, -1) << std::strerror(errno);
+		auto written = write(fd, content.data(), content.size());
+		close(fd);
+		ASSERT_EQ(static_cast<size_t>(written), content.size());
+	}
+};
+
+TEST_F(BatchReaderTest, ReadsFilesAcrossBatchesWithPadding)
+{
+	// more than one batch, with a missing and an empty file in between
+	std::vector<std::string> filenames;
+	std::vector<std::string> contents;
+	for (size_t i = 0; i < BatchReader::max_batch_size + 5; i++) {
+		filenames.push_back(std::format("{}.desktop", i));
+		contents.push_back(std::format("[Desktop Entry]\nName=App{}\n{}", i, std::string(i, 'x')));
+		if (i == 3)
+			contents.back().clear();
+		if (i != 7)
+			write_file(filenames.back(), contents.back());
+	}
+
+	BatchReader reader;
+	auto        files = reader.read(dfd, filenames);
+	ASSERT_EQ(files.size(), filenames.size());
+
+	for (const auto &[i, file] : files | std::views::enumerate) {
+		const auto &[buffer, size] = file;
+		if (i == 3 || i == 7) {
+			EXPECT_EQ(buffer, nullptr) << filenames[i];
+			EXPECT_EQ(size, 0) << filenames[i];
+			continue;
+		}
+		ASSERT_NE(buffer, nullptr) << filenames[i];
+		EXPECT_EQ(reinterpret_cast<std::uintptr_t>(buffer.get()) % desktop_file_alignment, 0u);
+		ASSERT_EQ(static_cast<size_t>(size), contents[i].size());
+		EXPECT_EQ(std::string_view(buffer.get(), size), contents[i]);
+		// the parser relies on at least one padded block past the end
+		constexpr int align = desktop_file_alignment;
+		for (int j = size; j < ((size + align) & ~(align - 1)); j++)
+			ASSERT_EQ(buffer.get()[j], '\n');
+	}
+}
@@ -64,6 +64,30 @@ Icon= eye candy
          .iconstring       = "eye candy",
          .startup_wm_class = "no way",
      }},
+    {"StopsAtNextGroup",
+     R"([Desktop Entry]
+Name=Firefox
+Exec=firefox %u
+
+[Desktop Action new-private-window]
+Name=New Private Window
+Icon=private
+StartupWMClass=private
+)",
+     {
+         .name             = "Firefox",
+         .iconstring       = "",
+         .startup_wm_class = "",
+     }},
+    // the header's newline is the last byte of the first 32- and 16-byte
+    // blocks, so the line start is carried into the next block
+    {"GroupHeaderAtBlockBoundary",
+     "[Desktop Entry]\nName=A\nIcon=bbb\n[X]\nStartupWMClass=wrong\n",
+     {
+         .name             = "A",
+         .iconstring       = "bbb",
+         .startup_wm_class = "",
+     }},
 };
 
 class DesktopFileInfoTest : public testing::TestWithParam<TestCase> {};
@@ -84,6 +108,25 @@ TEST_P(DesktopFileInfoTest, ParsesExpectedFields)
 	EXPECT_EQ(info, c.expected);
 }
 
+TEST_P(DesktopFileInfoTest, SimdLevelsAgree)
+{
+	const auto &c = GetParam();
+
+	int fd              = make_memfd(c.content);
+	auto [buffer, size] = read_desktop_file(fd);
+	close(fd);
+
+	ASSERT_NE(buffer, nullptr);
+
+	// each level implies the ones below it
+	for (auto level : {SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512BW}) {
+		if (level > get_simd_level())
+			break;
+		EXPECT_EQ(get_desktop_file_info(buffer.get(), size, level), c.expected)
+		    << "level " << static_cast<int>(level);
+	}
+}
+
 INSTANTIATE_TEST_SUITE_P(
     DesktopFiles,
     DesktopFileInfoTest,
@@ -103,6 +146,34 @@ TEST(ReadDesktopFileTest, ReturnsCorrectSizeAndContent)
 	EXPECT_EQ(std::string_view(buffer.get(), size), content);
 }
 
+TEST(ReadDesktopFileTest, ReadsOnlyPrefixWhenGroupEndsInIt)
+{
+	std::string content = "[Desktop Entry]\nName=test\n\n[Desktop Action a]\n";
+	content.append(2 * desktop_file_prefix_size, 'x');
+	int fd              = make_memfd(content);
+	auto [buffer, size] = read_desktop_file(fd);
+	close(fd);
+
+	ASSERT_NE(buffer, nullptr);
+	ASSERT_EQ(size, desktop_file_prefix_size);
+	EXPECT_EQ(get_desktop_file_info(buffer.get(), size).name, "test");
+}
+
+TEST(ReadDesktopFileTest, ReadsWholeFileWhenGroupContinues)
+{
+	std::string content = "[Desktop Entry]\n";
+	for (int i = 0; content.size() < 2 * desktop_file_prefix_size; i++)
+		content += std::format("Name[x{}]=translated\n", i);
+	content += "Icon=late\n";
+	int fd              = make_memfd(content);
+	auto [buffer, size] = read_desktop_file(fd);
+	close(fd);
+
+	ASSERT_NE(buffer, nullptr);
+	ASSERT_EQ(static_cast<size_t>(size), content.size());
+	EXPECT_EQ(get_desktop_file_info(buffer.get(), size).iconstring, "late");
+}
+
 TEST(ReadDesktopFileTest, HandlesEmptyFile)
 {
 	int fd              = make_memfd("");
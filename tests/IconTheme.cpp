@@ -0,0 +1,239 @@
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+import std;
+import llvm.Support;
+
+import wm.AppInfoLoader.IconTheme;
+
+using std::size_t, std::uint16_t, std::uint32_t;
+using namespace wm;
+namespace fs = llvm::sys::fs;
+
+static constexpr uint16_t has_suffix_svg = 2;
+static constexpr uint16_t has_suffix_png = 4;
+
+void write_file(const std::string &path, std::string_view content)
+{
+	if (auto ec = fs::create_directories(llvm::sys::path::parent_path(path)))
+		throw std::runtime_error(ec.message());
+
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	ASSERT_NE(fd, -1) << std::strerror(errno);
+	auto written = write(fd, content.data(), content.size());
+	close(fd);
+	ASSERT_EQ(static_cast<size_t>(written), content.size());
+}
+
+void set_mtime(const std::string &path, struct timespec mtime)
+{
+	struct timespec times[2] = {{.tv_sec = 0, .tv_nsec = UTIME_OMIT}, mtime};
+	ASSERT_EQ(utimensat(AT_FDCWD, path.c_str(), times, 0), 0) << std::strerror(errno);
+}
+
+struct CacheIcon {
+	std::string                                name;
+	/// (dir index, suffix flags)
+	std::vector<std::pair<uint16_t, uint16_t>> images;
+};
+
+/// An icon-theme.cache as gtk-update-icon-cache would write it.
+std::string build_icon_cache(std::span<const std::string> dirs, std::span<const CacheIcon> icons)
+{
+	constexpr uint32_t num_buckets = 7;
+
+	std::string out;
+	auto        put16 = [&](uint16_t v) {
+		out.push_back(static_cast<char>(v >> 8));
+		out.push_back(static_cast<char>(v));
+	};
+	auto put32 = [&](uint32_t v) {
+		put16(static_cast<uint16_t>(v >> 16));
+		put16(static_cast<uint16_t>(v));
+	};
+	auto set32 = [&](size_t at, uint32_t v) {
+		for (int i = 0; i < 4; i++)
+			out[at + i] = static_cast<char>(v >> (24 - 8 * i));
+	};
+	auto hash = [](std::string_view name) {
+		uint32_t h = 0;
+		for (signed char c : name)
+			h = (h << 5) - h + static_cast<uint32_t>(c);
+		return h;
+	};
+
+	put16(1);
+	put16(0);
+	put32(12);
+	put32(0); // dir list, set below
+	put32(num_buckets);
+	for (uint32_t i = 0; i < num_buckets; i++)
+		put32(0xffffffff);
+
+	std::vector<uint32_t> heads(num_buckets, 0xffffffff);
+	for (const auto &icon : icons) {
+		auto icon_at = static_cast<uint32_t>(out.size());
+		auto bucket  = hash(icon.name) % num_buckets;
+		put32(heads[bucket]);
+		put32(0);
+		put32(0);
+		heads[bucket] = icon_at;
+
+		set32(icon_at + 4, static_cast<uint32_t>(out.size()));
+		out += icon.name;
+		out.push_back('\0');
+
+		set32(icon_at + 8, static_cast<uint32_t>(out.size()));
+		put32(static_cast<uint32_t>(icon.images.size()));
+		for (auto [dir, flags] : icon.images) {
+			put16(dir);
+			put16(flags);
+			put32(0);
+		}
+	}
+	for (uint32_t i = 0; i < num_buckets; i++)
+		set32(16 + 4 * i, heads[i]);
+
+	set32(8, static_cast<uint32_t>(out.size()));
+	put32(static_cast<uint32_t>(dirs.size()));
+	auto names_at = out.size();
+	for (size_t i = 0; i < dirs.size(); i++)
+		put32(0);
+	for (size_t i = 0; i < dirs.size(); i++) {
+		set32(names_at + 4 * i, static_cast<uint32_t>(out.size()));
+		out += dirs[i];
+		out.push_back('\0');
+	}
+
+	return out;
+}
+
+class IconThemeTest : public testing::Test {
+protected:
+	std::string data_home;
+	std::string data_dir;
+	std::string cached_theme;
+
+	void SetUp() override
+	{
+		llvm::SmallString<256> dir;
+		if (auto ec = fs::createUniqueDirectory("icon_theme_test", dir))
+			throw std::runtime_error(ec.message());
+		data_home = dir.str();
+		if (auto ec = fs::createUniqueDirectory("icon_theme_test", dir))
+			throw std::runtime_error(ec.message());
+		data_dir = dir.str();
+
+		setenv("HOME", data_home.c_str(), 1);
+		setenv("XDG_DATA_HOME", data_home.c_str(), 1);
+		setenv("XDG_DATA_DIRS", data_dir.c_str(), 1);
+
+		cached_theme = data_home + "/icons/Cached/";
+		write_file(
+		    cached_theme + "index.theme",
+		    "[Icon Theme]\n"
+		    "Name=Cached\n"
+		    "Inherits=Plain\n"
+		    "Directories=16x16/apps,48x48/apps,48x48/actions,scalable/apps\n"
+		    "\n"
+		    "[16x16/apps]\nSize=16\nContext=Applications\nType=Fixed\n"
+		    "[48x48/apps]\nSize=48\nContext=Applications\nType=Fixed\n"
+		    "[48x48/actions]\nSize=48\nContext=Actions\nType=Fixed\n"
+		    "[scalable/apps]\nSize=48\nMinSize=8\nMaxSize=512\nContext=Applications\n"
+		    "Type=Scalable\n"
+		);
+		write_file(cached_theme + "16x16/apps/foo.png", "");
+		write_file(cached_theme + "48x48/apps/foo.png", "");
+		write_file(cached_theme + "48x48/actions/run.png", "");
+		write_file(cached_theme + "scalable/apps/bar.svg", "");
+		write_file(cached_theme + "scalable/apps/run.svg", "");
+
+		// cache dirs are in a different order than in index.theme
+		std::string cache_dirs[] = {"scalable/apps", "48x48/actions", "48x48/apps", "16x16/apps"};
+
+		CacheIcon cache_icons[] = {
+		    {"foo", {{3, has_suffix_png}, {2, has_suffix_png}}},
+		    {"bar", {{0, has_suffix_svg}}},
+		    {"run", {{1, has_suffix_png}, {0, has_suffix_svg}}},
+		    // only in the cache, so a hit shows that the cache is used
+		    {"cached-only", {{2, has_suffix_png}}},
+		};
+		write_file(cached_theme + "icon-theme.cache", build_icon_cache(cache_dirs, cache_icons));
+		struct stat st;
+		ASSERT_EQ(stat((cached_theme + "icon-theme.cache").c_str(), &st), 0);
+		set_mtime(cached_theme, st.st_mtim);
+
+		auto plain_theme = data_dir + "/icons/Plain/";
+		write_file(
+		    plain_theme + "index.theme",
+		    "[Icon Theme]\nName=Plain\nDirectories=32x32/apps\n\n[32x32/apps]\nSize=32\n"
+		);
+		write_file(plain_theme + "32x32/apps/plain.png", "");
+		write_file(plain_theme + "32x32/apps/plain.svg", "");
+
+		auto hicolor_theme = data_dir + "/icons/hicolor/";
+		write_file(
+		    hicolor_theme + "index.theme",
+		    "[Icon Theme]\nName=Hicolor\nDirectories=48x48/apps\n\n[48x48/apps]\nSize=48\n"
+		);
+		write_file(hicolor_theme + "48x48/apps/hicolor.svg", "");
+
+		write_file(data_dir + "/pixmaps/pix.png", "");
+	}
+
+	void TearDown() override
+	{
+		auto _ = fs::remove_directories(data_home);
+		auto _ = fs::remove_directories(data_dir);
+	}
+};
+
+TEST_F(IconThemeTest, PicksClosestSizeFromCache)
+{
+	std::string_view names[] = {"Cached"};
+
+	IconThemes themes48(names, 48);
+	EXPECT_EQ(themes48.find_icon("foo"), cached_theme + "48x48/apps/foo.png");
+	EXPECT_EQ(themes48.find_icon("bar"), cached_theme + "scalable/apps/bar.svg");
+	EXPECT_EQ(themes48.find_icon("cached-only"), cached_theme + "48x48/apps/cached-only.png");
+	// an exact match in an Applications dir beats one in another context
+	EXPECT_EQ(themes48.find_icon("run"), cached_theme + "scalable/apps/run.svg");
+	EXPECT_EQ(themes48.find_icon("foo.png"), cached_theme + "48x48/apps/foo.png");
+
+	IconThemes themes20(names, 20);
+	EXPECT_EQ(themes20.find_icon("foo"), cached_theme + "16x16/apps/foo.png");
+}
+
+TEST_F(IconThemeTest, FallsBackToInheritedThemesHicolorAndPixmaps)
+{
+	std::string_view names[] = {"Cached"};
+	IconThemes       themes(names, 48);
+
+	EXPECT_EQ(themes.find_icon("plain"), data_dir + "/icons/Plain/32x32/apps/plain.png");
+	EXPECT_EQ(themes.find_icon("hicolor"), data_dir + "/icons/hicolor/48x48/apps/hicolor.svg");
+	EXPECT_EQ(themes.find_icon("pix"), data_dir + "/pixmaps/pix.png");
+	EXPECT_EQ(themes.find_icon("missing"), "");
+}
+
+TEST_F(IconThemeTest, IgnoresStaleCache)
+{
+	struct stat st;
+	ASSERT_EQ(stat(cached_theme.c_str(), &st), 0);
+	st.st_mtim.tv_sec += 1;
+	set_mtime(cached_theme, st.st_mtim);
+
+	std::string_view names[] = {"Cached"};
+	IconThemes       themes(names, 48);
+
+	EXPECT_EQ(themes.find_icon("foo"), cached_theme + "48x48/apps/foo.png");
+	EXPECT_EQ(themes.find_icon("cached-only"), "");
+}
+
+TEST_F(IconThemeTest, LoadsNothingWithoutThemeNames)
+{
+	IconThemes themes({}, 48);
+	EXPECT_TRUE(themes.empty());
+	EXPECT_EQ(themes.find_icon("hicolor"), "");
+}
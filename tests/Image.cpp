@@ -0,0 +1,227 @@
+#include <gtest/gtest.h>
+#include <spng.h>
+#include <stdlib.h>
+#include <turbojpeg.h>
+
+import std;
+import llvm.Support;
+
+import wm.AppInfoLoader.Image;
+
+using std::size_t, std::uint8_t, std::uint32_t;
+using namespace wm;
+namespace fs = llvm::sys::fs;
+
+struct Rgba {
+	uint8_t r, g, b, a;
+
+	bool operator==(const Rgba &) const = default;
+};
+
+void write_file(const std::string &path, std::span<const uint8_t> content)
+{
+	std::ofstream file(path, std::ios::binary);
+	file.write(reinterpret_cast<const char *>(content.data()), content.size());
+	ASSERT_TRUE(file) << path;
+}
+
+std::vector<uint8_t> encode_png(uint32_t width, uint32_t height, std::span<const Rgba> pixels)
+{
+	spng_ctx *ctx = spng_ctx_new(SPNG_CTX_ENCODER);
+	spng_set_option(ctx, SPNG_ENCODE_TO_BUFFER, 1);
+
+	spng_ihdr ihdr{};
+	ihdr.width      = width;
+	ihdr.height     = height;
+	ihdr.bit_depth  = 8;
+	ihdr.color_type = SPNG_COLOR_TYPE_TRUECOLOR_ALPHA;
+	spng_set_ihdr(ctx, &ihdr);
+
+	std::vector<uint8_t> out;
+	if (!spng_encode_image(
+	        ctx, pixels.data(), pixels.size_bytes(), SPNG_FMT_PNG, SPNG_ENCODE_FINALIZE
+	    )) {
+		size_t size;
+		int    error;
+		auto  *png = static_cast<uint8_t *>(spng_get_png_buffer(ctx, &size, &error));
+		out.assign(png, png + size);
+		free(png);
+	}
+	spng_ctx_free(ctx);
+	return out;
+}
+
+std::vector<uint8_t> encode_gray_jpg(int width, int height, uint8_t value)
+{
+	std::vector<uint8_t> pixels(size_t(width) * height * 3, value);
+	tjhandle             handle = tjInitCompress();
+	unsigned char       *jpg    = nullptr;
+	unsigned long        size   = 0;
+	tjCompress2(handle, pixels.data(), width, 0, height, TJPF_RGB, &jpg, &size, TJSAMP_444, 95, 0);
+	std::vector<uint8_t> out(jpg, jpg + size);
+	tjFree(jpg);
+	tjDestroy(handle);
+	return out;
+}
+
+std::span<const Rgba> get_rgba(const Image &image)
+{
+	auto size = size_t{image.width} * image.height;
+	return {reinterpret_cast<const Rgba *>(image.buffer.get()), size};
+}
+
+class ImageTest : public testing::Test {
+protected:
+	std::string dir;
+
+	void SetUp() override
+	{
+		llvm::SmallString<256> path;
+		if (auto ec = fs::createUniqueDirectory("image_test", path))
+			throw std::runtime_error(ec.message());
+		dir = path.str();
+	}
+
+	void TearDown() override { auto _ = fs::remove_directories(dir); }
+};
+
+TEST_F(ImageTest, DownscalesLargePngs)
+{
+	constexpr Rgba red   = {255, 0, 0, 255};
+	constexpr Rgba clear = {0, 255, 0, 0};
+
+	// left half opaque, right half transparent with a color that must not
+	// bleed into the left
+	std::vector<Rgba> pixels(256 * 128, clear);
+	for (uint32_t y = 0; y < 128; y++)
+		std::fill_n(pixels.begin() + y * 256, 128, red);
+	// one opaque pixel in the first 4x4 box of the right half
+	pixels[128] = red;
+
+	auto path = dir + "/large.png";
+	write_file(path, encode_png(256, 128, pixels));
+
+	auto image = read_image(path.c_str(), 64);
+	ASSERT_TRUE(image.buffer);
+	EXPECT_EQ(image.width, 64u);
+	EXPECT_EQ(image.height, 32u);
+	EXPECT_EQ(image.format, ImageFormat::RGBA);
+
+	auto out = get_rgba(image);
+	EXPECT_EQ(out[0], red);
+	EXPECT_EQ(out[31], red);
+	EXPECT_EQ(out[32], (Rgba{255, 0, 0, 16}));
+	EXPECT_EQ(out[33].a, 0);
+	EXPECT_EQ(out[64 + 32].a, 0);
+	EXPECT_EQ(out[64 * 32 - 1].a, 0);
+}
+
+TEST_F(ImageTest, KeepsSmallPngs)
+{
+	std::vector<Rgba> pixels(16 * 8, Rgba{1, 2, 3, 4});
+	auto              path = dir + "/small.png";
+	write_file(path, encode_png(16, 8, pixels));
+
+	auto image = read_image(path.c_str(), 64);
+	ASSERT_TRUE(image.buffer);
+	EXPECT_EQ(image.width, 16u);
+	EXPECT_EQ(image.height, 8u);
+	EXPECT_TRUE(std::ranges::equal(get_rgba(image), pixels));
+}
+
+TEST_F(ImageTest, DownscalesLargeJpegs)
+{
+	auto path = dir + "/large.jpg";
+	write_file(path, encode_gray_jpg(1024, 512, 128));
+
+	auto image = read_image(path.c_str(), 100);
+	ASSERT_TRUE(image.buffer);
+	EXPECT_EQ(image.width, 100u);
+	EXPECT_EQ(image.height, 50u);
+	EXPECT_EQ(image.format, ImageFormat::RGB);
+
+	auto bytes = std::span{image.buffer.get(), size_t{image.width} * image.height * 3};
+	EXPECT_TRUE(std::ranges::all_of(bytes, [](uint8_t v) { return v >= 126 && v <= 130; }));
+}
+
+TEST_F(ImageTest, DownscalesJpegsToOddSizes)
+{
+	auto path = dir + "/odd.jpg";
+	write_file(path, encode_gray_jpg(200, 200, 128));
+
+	// decoded at 5/8, then box filtered
+	auto image = read_image(path.c_str(), 120);
+	ASSERT_TRUE(image.buffer);
+	EXPECT_EQ(image.width, 120u);
+	EXPECT_EQ(image.height, 120u);
+
+	auto bytes = std::span{image.buffer.get(), size_t{image.width} * image.height * 3};
+	EXPECT_TRUE(std::ranges::all_of(bytes, [](uint8_t v) { return v >= 126 && v <= 130; }));
+}
+
+Image make_image(uint32_t width, uint32_t height, ImageFormat format, std::span<const uint8_t> px)
+{
+	ImageBuffer buffer(new uint8_t[px.size()]);
+	std::ranges::copy(px, buffer.get());
+	return {std::move(buffer), width, height, format};
+}
+
+// odd sizes so that both the vector kernels and the scalar tails run
+static constexpr uint32_t odd_width  = 37;
+static constexpr uint32_t odd_height = 3;
+
+TEST(NormalizeImageTest, ExpandsRgb)
+{
+	std::vector<uint8_t> rgb(size_t{odd_width} * odd_height * 3);
+	for (size_t i = 0; i < rgb.size(); i++)
+		rgb[i] = static_cast<uint8_t>(i * 7);
+
+	auto image = normalize_image(make_image(odd_width, odd_height, ImageFormat::RGB, rgb));
+	ASSERT_TRUE(image.buffer);
+	EXPECT_EQ(image.format, ImageFormat::PremultipliedRGBA);
+
+	auto out = get_rgba(image);
+	for (size_t i = 0; i < out.size(); i++)
+		EXPECT_EQ(out[i], (Rgba{rgb[i * 3], rgb[i * 3 + 1], rgb[i * 3 + 2], 255})) << i;
+}
+
+TEST(NormalizeImageTest, PremultipliesRgba)
+{
+	std::vector<Rgba> pixels(size_t{odd_width} * odd_height);
+	for (size_t i = 0; i < pixels.size(); i++) {
+		auto v    = static_cast<uint8_t>(i * 7);
+		pixels[i] = {255, v, 128, v};
+	}
+	std::span bytes{reinterpret_cast<const uint8_t *>(pixels.data()), pixels.size() * 4};
+
+	auto image = normalize_image(make_image(odd_width, odd_height, ImageFormat::RGBA, bytes));
+	ASSERT_TRUE(image.buffer);
+	EXPECT_EQ(image.format, ImageFormat::PremultipliedRGBA);
+
+	auto out = get_rgba(image);
+	for (size_t i = 0; i < out.size(); i++) {
+		auto a           = pixels[i].a;
+		auto premultiply = [a](uint8_t c) {
+			return static_cast<uint8_t>((c * a * 2 + 255) / 510);
+		};
+		EXPECT_EQ(out[i], (Rgba{a, premultiply(a), premultiply(128), a})) << i;
+	}
+}
+
+TEST(NormalizeImageTest, SwizzlesBgra)
+{
+	std::vector<uint8_t> bgra(size_t{odd_width} * odd_height * 4);
+	for (size_t i = 0; i < bgra.size(); i += 4) {
+		bgra[i]     = 1;
+		bgra[i + 1] = 2;
+		bgra[i + 2] = 3;
+		bgra[i + 3] = 4;
+	}
+
+	auto image = normalize_image(make_image(odd_width, odd_height, ImageFormat::BGRA, bgra));
+	ASSERT_TRUE(image.buffer);
+	EXPECT_EQ(image.format, ImageFormat::PremultipliedRGBA);
+	EXPECT_TRUE(std::ranges::all_of(get_rgba(image), [](Rgba p) {
+		return p == Rgba{3, 2, 1, 4};
+	}));
+}
@@ -0,0 +1,154 @@
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+import std;
+import llvm.Support;
+
+import wm.AppInfoLoader.Image;
+import wm.AppInfoLoader.ImageCache;
+
+using std::size_t;
+using namespace wm;
+namespace fs = llvm::sys::fs;
+
+static constexpr int icon_size = 64;
+
+void write_file(const std::string &path, std::string_view content)
+{
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	ASSERT_NE(fd, -1) << std::strerror(errno);
+	auto written = write(fd, content.data(), content.size());
+	close(fd);
+	ASSERT_EQ(static_cast<size_t>(written), content.size());
+}
+
+void set_mtime(const std::string &path, time_t sec)
+{
+	struct timespec times[2] = {
+	    {.tv_sec = 0, .tv_nsec = UTIME_OMIT},
+	    {.tv_sec = sec, .tv_nsec = 0},
+	};
+	ASSERT_EQ(utimensat(AT_FDCWD, path.c_str(), times, 0), 0) << std::strerror(errno);
+}
+
+std::string make_svg(std::string_view fill)
+{
+	return std::format(
+	    "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"16\" height=\"16\">"
+	    "<rect width=\"16\" height=\"16\" fill=\"{}\"/></svg>",
+	    fill
+	);
+}
+
+std::vector<std::uint8_t> get_pixels(const Image &image)
+{
+	auto size = size_t{image.width} * image.height * get_pixel_size(image.format);
+	return {image.buffer.get(), image.buffer.get() + size};
+}
+
+class ImageCacheTest : public testing::Test {
+protected:
+	std::string root;
+	std::string cache_dir;
+
+	void SetUp() override
+	{
+		llvm::SmallString<256> dir;
+		if (auto ec = fs::createUniqueDirectory("image_cache_test", dir))
+			throw std::runtime_error(ec.message());
+		root      = dir.str();
+		cache_dir = root + "/cache/wm/icons";
+		setenv("XDG_CACHE_HOME", (root + "/cache").c_str(), 1);
+	}
+
+	void TearDown() override { auto _ = fs::remove_directories(root); }
+
+	std::vector<std::string> list_entries()
+	{
+		std::vector<std::string> entries;
+		std::error_code          ec;
+		for (fs::directory_iterator it(cache_dir, ec), end; it != end && !ec; it.increment(ec))
+			entries.push_back(it->path());
+		std::ranges::sort(entries);
+		return entries;
+	}
+};
+
+TEST_F(ImageCacheTest, MapsStoredIcons)
+{
+	auto icon = root + "/red.svg";
+	write_file(icon, make_svg("#ff0000"));
+
+	ImageCache cache;
+	auto       decoded = cache.read(icon.c_str(), icon_size);
+	ASSERT_TRUE(decoded.buffer);
+	EXPECT_EQ(decoded.width, std::uint32_t{icon_size});
+	ASSERT_EQ(list_entries().size(), 1);
+
+	auto mapped = cache.read(icon.c_str(), icon_size);
+	ASSERT_TRUE(mapped.buffer);
+	EXPECT_NE(mapped.buffer.get_deleter().mapping, nullptr);
+	EXPECT_EQ(mapped.width, decoded.width);
+	EXPECT_EQ(mapped.height, decoded.height);
+	EXPECT_EQ(mapped.format, ImageFormat::PremultipliedRGBA);
+	EXPECT_EQ(mapped.format, decoded.format);
+	EXPECT_EQ(get_pixels(mapped), get_pixels(decoded));
+
+	// a different size is a different entry
+	auto smaller = cache.read(icon.c_str(), icon_size / 2);
+	EXPECT_EQ(smaller.width, std::uint32_t{icon_size / 2});
+	EXPECT_EQ(list_entries().size(), 2);
+}
+
+TEST_F(ImageCacheTest, DecodesModifiedIconsAgain)
+{
+	auto icon = root + "/icon.svg";
+	write_file(icon, make_svg("#ff0000"));
+	set_mtime(icon, 1'000'000);
+
+	ImageCache cache;
+	auto       red = get_pixels(cache.read(icon.c_str(), icon_size));
+
+	write_file(icon, make_svg("#0000ff"));
+	set_mtime(icon, 1'000'001);
+	auto blue = cache.read(icon.c_str(), icon_size);
+	ASSERT_TRUE(blue.buffer);
+	EXPECT_EQ(blue.buffer.get_deleter().mapping, nullptr);
+	EXPECT_NE(get_pixels(blue), red);
+	EXPECT_EQ(list_entries().size(), 2);
+}
+
+TEST_F(ImageCacheTest, EvictsLeastRecentlyUsedEntries)
+{
+	auto a = root + "/a.svg";
+	auto b = root + "/b.svg";
+	auto c = root + "/c.svg";
+	write_file(a, make_svg("#ff0000"));
+	write_file(b, make_svg("#00ff00"));
+	write_file(c, make_svg("#0000ff"));
+
+	// room for two entries of 64x64 BGRA plus their headers, but not three
+	ImageCache cache(46'000);
+	auto       _         = cache.read(a.c_str(), icon_size);
+	auto       a_entries = list_entries();
+	ASSERT_EQ(a_entries.size(), 1);
+	auto _       = cache.read(b.c_str(), icon_size);
+	auto entries = list_entries();
+	ASSERT_EQ(entries.size(), 2);
+	auto a_entry = a_entries[0];
+	auto b_entry = entries[0] == a_entry ? entries[1] : entries[0];
+
+	// b was used after a, but a is used again before c is added
+	set_mtime(a_entry, 1'000'000);
+	set_mtime(b_entry, 1'000'001);
+	auto hit = cache.read(a.c_str(), icon_size);
+	EXPECT_NE(hit.buffer.get_deleter().mapping, nullptr);
+	auto _ = cache.read(c.c_str(), icon_size);
+
+	entries = list_entries();
+	EXPECT_EQ(entries.size(), 2);
+	EXPECT_TRUE(std::ranges::contains(entries, a_entry));
+	EXPECT_FALSE(std::ranges::contains(entries, b_entry));
+}
@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+
+import std;
+
+import wm.Support.ShelfPacker;
+
+using namespace wm;
+
+static bool overlaps(const PackedRect &a, const PackedRect &b)
+{
+	return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height
+	    && b.y < a.y + a.height;
+}
+
+TEST(ShelfPackerTest, PacksRowsWithoutOverlap)
+{
+	ShelfPacker packer(100, 100);
+
+	std::vector<PackedRect> rects;
+	for (int i = 0; i < 9; i++) {
+		auto rect = packer.insert(30, 30);
+		ASSERT_TRUE(rect) << i;
+		EXPECT_LE(rect->x + rect->width, 100u);
+		EXPECT_LE(rect->y + rect->height, 100u);
+		rects.push_back(*rect);
+	}
+	for (std::size_t i = 0; i < rects.size(); i++) {
+		for (std::size_t j = i + 1; j < rects.size(); j++)
+			EXPECT_FALSE(overlaps(rects[i], rects[j])) << i << ' ' << j;
+	}
+	EXPECT_EQ(packer.live_area(), 9u * 30 * 30);
+
+	// a fourth row of 30 does not fit, a row of 10 does
+	EXPECT_FALSE(packer.insert(30, 30));
+	auto low = packer.insert(100, 10);
+	ASSERT_TRUE(low);
+	EXPECT_EQ(low->y, 90u);
+}
+
+TEST(ShelfPackerTest, PrefersTightShelves)
+{
+	ShelfPacker packer(100, 100);
+	auto        tall   = packer.insert(20, 40);
+	auto        short_ = packer.insert(20, 20);
+	ASSERT_TRUE(tall && short_);
+	EXPECT_EQ(short_->y, 40u);
+
+	// fits both shelves but wastes less of the short one
+	auto small = packer.insert(20, 18);
+	ASSERT_TRUE(small);
+	EXPECT_EQ(small->y, short_->y);
+
+	// would waste more than a quarter of both shelves
+	auto tiny = packer.insert(20, 5);
+	ASSERT_TRUE(tiny);
+	EXPECT_EQ(tiny->y, 60u);
+}
+
+TEST(ShelfPackerTest, ReclaimsSpaceOnReset)
+{
+	ShelfPacker packer(64, 64);
+	auto        a = packer.insert(64, 32);
+	auto        b = packer.insert(64, 32);
+	ASSERT_TRUE(a && b);
+	EXPECT_FALSE(packer.insert(64, 32));
+
+	packer.remove(*a);
+	EXPECT_EQ(packer.live_area(), 64u * 32);
+	// removing does not free the shelf space
+	EXPECT_FALSE(packer.insert(64, 32));
+
+	packer.reset(128, 128);
+	EXPECT_EQ(packer.live_area(), 0u);
+	EXPECT_EQ(packer.width(), 128u);
+	auto c = packer.insert(128, 128);
+	ASSERT_TRUE(c);
+	EXPECT_EQ(c->x, 0u);
+	EXPECT_EQ(c->y, 0u);
+}